@@ -0,0 +1,378 @@
+#ifndef MODULES_CRYPTO_H_
+#define MODULES_CRYPTO_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef HYBRID_CRYPTO_OPENSSL
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#endif
+using namespace std;
+
+/*
+Cryptographic primitives used by the endpoint modules.
+
+This header has no dependency on the simulation kernel so the primitives
+can be benchmarked standalone (see bench/).
+
+Cipher API:
+  CipherKey           per-connection key schedule, built once per shared key
+  cipherTransform()   buffer in, buffer out (in == out for in-place use)
+  simpleEncrypt()     string convenience wrappers around cipherTransform()
+
+Backends (chosen at build time):
+  default                  XOR placeholder, ciphertext length == plaintext length
+  -DHYBRID_CRYPTO_OPENSSL  OpenSSL AEAD, AES-128-GCM (add -DHYBRID_AEAD_CHACHA20
+                           for ChaCha20-Poly1305); link with -lcrypto. Output is
+                           hex(nonce || ciphertext || tag) so it survives string pars.
+*/
+
+// Widest vector lane used by the XOR kernel
+static const size_t CIPHER_LANE = 32;
+
+#ifdef HYBRID_CRYPTO_OPENSSL
+static const size_t AEAD_NONCE_LEN = 12;
+static const size_t AEAD_TAG_LEN = 16;
+
+// Keyed OpenSSL contexts, set up once per connection key so per-packet
+// calls only load a new nonce
+struct AeadState {
+    EVP_CIPHER_CTX* sealCtx;
+    EVP_CIPHER_CTX* openCtx;
+    unsigned char salt[4];
+    unsigned long long counter;
+
+    explicit AeadState(const string& key) : counter(0) {
+#ifdef HYBRID_AEAD_CHACHA20
+        const EVP_CIPHER* cipher = EVP_chacha20_poly1305();
+#else
+        const EVP_CIPHER* cipher = EVP_aes_128_gcm();
+#endif
+        // Stretch the shared secret to the cipher's key size
+        unsigned char keyBytes[32];
+        int keyLen = EVP_CIPHER_key_length(cipher);
+        for (int i = 0; i < keyLen; i++) {
+            keyBytes[i] = (unsigned char)(key[i % key.size()] + 31 * (i / key.size()));
+        }
+        sealCtx = EVP_CIPHER_CTX_new();
+        openCtx = EVP_CIPHER_CTX_new();
+        EVP_EncryptInit_ex(sealCtx, cipher, nullptr, keyBytes, nullptr);
+        EVP_DecryptInit_ex(openCtx, cipher, nullptr, keyBytes, nullptr);
+        RAND_bytes(salt, sizeof(salt));
+    }
+
+    ~AeadState() {
+        EVP_CIPHER_CTX_free(sealCtx);
+        EVP_CIPHER_CTX_free(openCtx);
+    }
+
+    AeadState(const AeadState&) = delete;
+    AeadState& operator=(const AeadState&) = delete;
+
+    void nextNonce(unsigned char* nonce) {
+        memcpy(nonce, salt, sizeof(salt));
+        unsigned long long c = counter++;
+        for (int i = 0; i < 8; i++) {
+            nonce[4 + i] = (unsigned char)(c >> (8 * i));
+        }
+    }
+};
+#endif
+
+// Per-connection key schedule: the key with the 0xAA whitening folded in,
+// repeated so that a full lane starting anywhere inside the key period can
+// be loaded contiguously
+struct CipherKey {
+    string key;
+    vector<unsigned char> schedule;
+    size_t laneStep;      // CIPHER_LANE % period, keeps the pad index in range
+    size_t halfLaneStep;  // (CIPHER_LANE / 2) % period
+#ifdef HYBRID_CRYPTO_OPENSSL
+    shared_ptr<AeadState> aead;  // Copies share contexts and the nonce counter
+#endif
+
+    CipherKey() : laneStep(0), halfLaneStep(0) {}
+    CipherKey(const string& k) { setKey(k); }
+    CipherKey(const char* k) { setKey(string(k)); }
+
+    void setKey(const string& k) {
+        key = k;
+        schedule.resize(key.empty() ? 0 : key.size() + CIPHER_LANE);
+        for (size_t i = 0; i < schedule.size(); i++) {
+            schedule[i] = (unsigned char)(key[i % key.size()] ^ 0xAA);
+        }
+        laneStep = key.empty() ? 0 : CIPHER_LANE % key.size();
+        halfLaneStep = key.empty() ? 0 : (CIPHER_LANE / 2) % key.size();
+#ifdef HYBRID_CRYPTO_OPENSSL
+        aead = key.empty() ? nullptr : make_shared<AeadState>(key);
+#endif
+    }
+
+    bool empty() const { return key.empty(); }
+    size_t period() const { return key.size(); }
+};
+
+// Reference kernel, one byte at a time. 'offset' is the position of in[0]
+// in the keystream, so long payloads can be processed in pieces.
+static void cipherTransformScalar(const unsigned char* in, unsigned char* out, size_t len,
+                                  const CipherKey& ks, size_t offset = 0) {
+    if (ks.empty()) {
+        if (in != out) memmove(out, in, len);
+        return;
+    }
+    const unsigned char* pad = ks.schedule.data();
+    size_t period = ks.period();
+    size_t p = offset % period;
+    for (size_t i = 0; i < len; i++) {
+        out[i] = in[i] ^ pad[p];
+        if (++p == period) p = 0;
+    }
+}
+
+// Vectorized kernel: XORs a full lane of payload against the matching
+// window of the key schedule per step, then finishes the tail bytewise
+static void cipherTransform(const unsigned char* in, unsigned char* out, size_t len,
+                            const CipherKey& ks, size_t offset = 0) {
+    if (ks.empty()) {
+        if (in != out) memmove(out, in, len);
+        return;
+    }
+    const unsigned char* pad = ks.schedule.data();
+    size_t period = ks.period();
+    size_t p = offset % period;
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i k = _mm256_loadu_si256((const __m256i*)(pad + p));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(d, k));
+        p += ks.laneStep;
+        if (p >= period) p -= period;
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i k = _mm_loadu_si128((const __m128i*)(pad + p));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(d, k));
+        p += ks.halfLaneStep;
+        if (p >= period) p -= period;
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t d = vld1q_u8(in + i);
+        uint8x16_t k = vld1q_u8(pad + p);
+        vst1q_u8(out + i, veorq_u8(d, k));
+        p += ks.halfLaneStep;
+        if (p >= period) p -= period;
+    }
+#endif
+    cipherTransformScalar(in + i, out + i, len - i, ks, p);
+}
+
+static void cipherTransform(const char* in, char* out, size_t len,
+                            const CipherKey& ks, size_t offset = 0) {
+    cipherTransform((const unsigned char*)in, (unsigned char*)out, len, ks, offset);
+}
+
+#ifdef HYBRID_CRYPTO_OPENSSL
+static string toHex(const string& data);
+static void toHex(const string& data, string& out);
+static string fromHex(const string& hexStr);
+
+// Seals one payload into a caller-provided buffer of at least
+// len + AEAD_NONCE_LEN + AEAD_TAG_LEN bytes; returns bytes written
+static size_t aeadSeal(const unsigned char* in, size_t len, unsigned char* out,
+                       const CipherKey& key) {
+    AeadState& st = *key.aead;
+    unsigned char* nonce = out;
+    unsigned char* body = out + AEAD_NONCE_LEN;
+    int n = 0, tail = 0;
+    st.nextNonce(nonce);
+    EVP_EncryptInit_ex(st.sealCtx, nullptr, nullptr, nullptr, nonce);
+    EVP_EncryptUpdate(st.sealCtx, body, &n, in, (int)len);
+    EVP_EncryptFinal_ex(st.sealCtx, body + n, &tail);
+    EVP_CIPHER_CTX_ctrl(st.sealCtx, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_LEN, body + n + tail);
+    return AEAD_NONCE_LEN + n + tail + AEAD_TAG_LEN;
+}
+
+// Opens a sealed payload; returns false if authentication fails
+static bool aeadOpen(const unsigned char* in, size_t len, unsigned char* out, size_t& outLen,
+                     const CipherKey& key) {
+    if (len < AEAD_NONCE_LEN + AEAD_TAG_LEN) return false;
+    AeadState& st = *key.aead;
+    size_t bodyLen = len - AEAD_NONCE_LEN - AEAD_TAG_LEN;
+    int n = 0, tail = 0;
+    EVP_DecryptInit_ex(st.openCtx, nullptr, nullptr, nullptr, in);
+    EVP_DecryptUpdate(st.openCtx, out, &n, in + AEAD_NONCE_LEN, (int)bodyLen);
+    EVP_CIPHER_CTX_ctrl(st.openCtx, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_LEN,
+                        (void*)(in + AEAD_NONCE_LEN + bodyLen));
+    if (EVP_DecryptFinal_ex(st.openCtx, out + n, &tail) <= 0) return false;
+    outLen = n + tail;
+    return true;
+}
+#endif
+
+// Simple AES simulation (placeholder - in production use real crypto library)
+static string simpleEncrypt(const string& data, const CipherKey& key) {
+#ifdef HYBRID_CRYPTO_OPENSSL
+    string sealed(data.size() + AEAD_NONCE_LEN + AEAD_TAG_LEN, '\0');
+    aeadSeal((const unsigned char*)data.data(), data.size(), (unsigned char*)&sealed[0], key);
+    return toHex(sealed);
+#else
+    string encrypted(data.size(), '\0');
+    cipherTransform(data.data(), &encrypted[0], data.size(), key);
+    return encrypted;
+#endif
+}
+
+static string simpleEncrypt(const string& data, const string& key) {
+    return simpleEncrypt(data, CipherKey(key));
+}
+
+static string simpleDecrypt(const string& data, const CipherKey& key) {
+#ifdef HYBRID_CRYPTO_OPENSSL
+    string sealed = fromHex(data);
+    string plain(sealed.size(), '\0');
+    size_t len = 0;
+    if (!aeadOpen((const unsigned char*)sealed.data(), sealed.size(), (unsigned char*)&plain[0],
+                  len, key)) {
+        return "";
+    }
+    plain.resize(len);
+    return plain;
+#else
+    return simpleEncrypt(data, key); // XOR is symmetric
+#endif
+}
+
+static string simpleDecrypt(const string& data, const string& key) {
+    return simpleDecrypt(data, CipherKey(key));
+}
+
+// Encrypts several payloads for the same connection in one call, reusing
+// the keyed context and output storage across packets. Each output is what
+// simpleEncrypt() returns for that payload, so simpleDecrypt() opens it.
+static void simpleEncryptBatch(const vector<string>& payloads, vector<string>& out,
+                               const CipherKey& key) {
+    out.resize(payloads.size());
+#ifdef HYBRID_CRYPTO_OPENSSL
+    string sealed;
+#endif
+    for (size_t i = 0; i < payloads.size(); i++) {
+        const string& data = payloads[i];
+#ifdef HYBRID_CRYPTO_OPENSSL
+        sealed.resize(data.size() + AEAD_NONCE_LEN + AEAD_TAG_LEN);
+        aeadSeal((const unsigned char*)data.data(), data.size(), (unsigned char*)&sealed[0], key);
+        toHex(sealed, out[i]);
+#else
+        out[i].resize(data.size());
+        cipherTransform(data.data(), &out[i][0], data.size(), key);
+#endif
+    }
+}
+
+// ECDH key exchange simulation (simplified)
+static string generateECDHPublicKey(long address) {
+    // Simplified: just generate a pseudo-key based on address
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lx", address * 0x12345 + 0x6789ABCD);
+    return buf;
+}
+
+// Toy Diffie-Hellman group standing in for the curve: both sides of an
+// exchange derive the same secret, which session resumption depends on
+static const unsigned long long DH_PRIME = 2147483647ULL;  // 2^31 - 1
+static const unsigned long long DH_GENERATOR = 7ULL;
+
+static unsigned long long modPow(unsigned long long base, unsigned long long exp,
+                                 unsigned long long mod) {
+    unsigned long long result = 1;
+    base %= mod;
+    while (exp > 0) {
+        if (exp & 1) result = (result * base) % mod;
+        base = (base * base) % mod;
+        exp >>= 1;
+    }
+    return result;
+}
+
+static unsigned long long privateExponent(const string& myPrivate) {
+    return strtoull(myPrivate.c_str(), nullptr, 16) % (DH_PRIME - 1) + 1;
+}
+
+static string deriveECDHPublicKey(const string& myPrivate) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llx", modPow(DH_GENERATOR, privateExponent(myPrivate), DH_PRIME));
+    return buf;
+}
+
+static string computeSharedSecret(const string& myPrivate, const string& theirPublic) {
+    unsigned long long theirs = strtoull(theirPublic.c_str(), nullptr, 16) % DH_PRIME;
+    char combined[32];
+    int n = snprintf(combined, sizeof(combined), "%llx",
+                     modPow(theirs, privateExponent(myPrivate), DH_PRIME));
+    string secret(16, '\0');
+    for (size_t i = 0; i < 16; i++) { // 128-bit key
+        secret[i] = (char)((combined[i % n] ^ 0x5A) + i);
+    }
+    return secret;
+}
+
+// Into out, reusing its storage
+static void toHex(const string& data, string& out) {
+    static const char* digits = "0123456789abcdef";
+    out.resize(data.size() * 2);
+    for (size_t i = 0; i < data.size(); i++) {
+        unsigned char c = data[i];
+        out[2 * i] = digits[c >> 4];
+        out[2 * i + 1] = digits[c & 0x0F];
+    }
+}
+
+static string toHex(const string& data) {
+    string out;
+    toHex(data, out);
+    return out;
+}
+
+static int hexNibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 0;
+}
+
+static string fromHex(const string& hexStr) {
+    string out(hexStr.size() / 2, '\0');
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = (char)((hexNibble(hexStr[2 * i]) << 4) | hexNibble(hexStr[2 * i + 1]));
+    }
+    return out;
+}
+
+// Key derivation (HKDF stand-in): 128-bit key bound to a secret and a label
+static string deriveSessionKey(const string& secret, const string& label) {
+    unsigned long long h = 0xcbf29ce484222325ULL;  // FNV-1a
+    string input = secret + "|" + label;
+    string key(16, '\0');
+    for (size_t i = 0; i < 16; i++) {
+        for (unsigned char c : input) {
+            h = (h ^ c) * 0x100000001b3ULL;
+        }
+        h ^= i;
+        key[i] = (char)(((h >> 24) & 0x7F) | 0x01);  // never NUL, safe in string pars
+    }
+    return key;
+}
+
+#endif // MODULES_CRYPTO_H_
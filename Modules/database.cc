@@ -9,17 +9,19 @@ class DatabaseServer : public cSimpleModule {
   private:
     int addr = 0;
     
+    // Per-peer TCP, key and SYN tracking state
+    PeerTable peers;
+    
     // Security
-    map<long, string> sharedKeys;
+    CryptoCostModel cryptoCost;          // CPU time charged for crypto work
+    cMessage* cryptoTimer;               // CPU free again: held packets go out
     string myPublicKey;
     string myPrivateKey;
     
-    // TCP connections
-    map<long, TCPConnection> tcpConnections;
+    // Session resumption (0-RTT)
+    SessionTicketIssuer tickets;
     
     // SYN flood protection
-    map<long, int> synCounts;
-    map<long, simtime_t> synTimestamps;
     double synRateLimit;
     cMessage* synFloodCheckTimer;
     
@@ -27,23 +29,29 @@ class DatabaseServer : public cSimpleModule {
     priority_queue<cMessage*, vector<cMessage*>, MessagePriorityCompare> queryQueue;
     cMessage* processQueryTimer;
     
-    // Transaction management
-    map<long, int> activeTransactions;  // client -> transaction count
-    
-    // Congestion control
-    map<long, double> cwndMap;
-    
     // Transmission queue management
     cQueue txQueue;
     cMessage* endTxEvent;
+    PacketPool pool;         // Recycled packets, see mk() and pool.release()
+    SegmentationOffload gso; // Results leave as one packet, cut into segments at egress
+    PathMtuCache paths;      // Path MTU discovery for the segments
     
   protected:
+    // Pooled packet factory; shadows the global mk() inside this module
+    cPacket* mk(const char* name, int kind, long src, long dst) {
+        return pool.get(name, kind, src, dst);
+    }
+    
     void initialize() override {
         addr = par("address");
         
         // Initialize security
         myPrivateKey = generateECDHPublicKey(addr);
-        myPublicKey = generateECDHPublicKey(addr * 2);
+        myPublicKey = deriveECDHPublicKey(myPrivateKey);
+        cryptoCost.configure(this);
+        cryptoTimer = new cMessage("crypto");
+        peers.configure(this);
+        tickets.configure(this, myPrivateKey);
         
         // SYN flood protection
         synRateLimit = par("synRateLimit").doubleValue();
@@ -55,7 +63,10 @@ class DatabaseServer : public cSimpleModule {
         
         // Initialize transmission queue
         txQueue.setName("txQueue");
-        endTxEvent = nullptr;
+        endTxEvent = new cMessage("endTx");
+        gso.configure(this);
+        paths.configure(this);
+        gso.paths = &paths;
         
         EV_INFO << "Database server " << addr << " initialized\n";
     }
@@ -67,6 +78,13 @@ class DatabaseServer : public cSimpleModule {
         }
         
         int kind = msg->getKind();
+        peers.touch(SRC(msg));  // Keep active peers off the idle/eviction end
+        
+        // 0-RTT data carries a resumption ticket instead of a fresh handshake
+        if (msg->hasPar("ticket") && !acceptEarlyData(msg)) {
+            pool.release(msg);
+            return;
+        }
         
         switch (kind) {
             case KEY_EXCHANGE:
@@ -84,23 +102,25 @@ class DatabaseServer : public cSimpleModule {
             case TCP_FIN:
                 handleTCPFin(msg);
                 break;
+            case PACKET_TOO_BIG:
+                handlePacketTooBig(msg);
+                break;
             default:
                 EV_WARN << "DatabaseServer " << addr << " unexpected kind=" << kind << "\n";
-                delete msg;
+                pool.release(msg);
         }
     }
     
     void handleSelfMessage(cMessage* msg) {
         if (msg == synFloodCheckTimer) {
             simtime_t now = simTime();
-            for (auto it = synTimestamps.begin(); it != synTimestamps.end(); ) {
-                if (now - it->second > 60.0) {
-                    synCounts.erase(it->first);
-                    it = synTimestamps.erase(it);
-                } else {
-                    ++it;
+            peers.forEach([&](PeerState& peer) {
+                if (peer.synCount > 0 && now - peer.synTimestamp > 60.0) {
+                    peer.synCount = 0;
                 }
-            }
+            });
+            tickets.prune();
+            peers.age();
             scheduleAt(simTime() + 1.0, synFloodCheckTimer);
         } else if (msg == processQueryTimer) {
             if (!queryQueue.empty()) {
@@ -114,16 +134,27 @@ class DatabaseServer : public cSimpleModule {
             }
         } else if (msg == endTxEvent) {
             // Transmission finished, send next packet if available
-            endTxEvent = nullptr;
             if (!txQueue.isEmpty()) {
                 cMessage* nextMsg = (cMessage*)txQueue.pop();
                 startTransmission(nextMsg);
             }
+        } else if (msg == cryptoTimer) {
+            cryptoCost.release([&](cMessage* held) { sendPacketOnGate(held); });
+            if (cryptoCost.hasHeld()) scheduleAt(cryptoCost.busyUntil, cryptoTimer);
+        } else if (msg->isPacket()) {
+            // Response released after its service time
+            sendPacketOnGate(msg);
         }
     }
     
     // Transmission queue management functions
     void sendPacketOnGate(cMessage* msg) {
+        // Hold the packet until the CPU has finished pending crypto work
+        if (cryptoCost.hold(msg)) {
+            if (!cryptoTimer->isScheduled()) scheduleAt(max(simTime(), cryptoCost.busyUntil), cryptoTimer);
+            return;
+        }
+        
         cGate* outGate = gate("ppp$o");
         
         // Check if channel is busy
@@ -132,7 +163,7 @@ class DatabaseServer : public cSimpleModule {
             // Channel busy, queue the packet
             txQueue.insert(msg);
             EV_INFO << "DB" << addr << " channel busy, queued packet " << msg->getName() << "\n";
-        } else if (endTxEvent != nullptr) {
+        } else if (endTxEvent->isScheduled()) {
             // Already transmitting, queue the packet
             txQueue.insert(msg);
             EV_INFO << "DB" << addr << " transmission in progress, queued packet " << msg->getName() << "\n";
@@ -142,21 +173,27 @@ class DatabaseServer : public cSimpleModule {
         }
     }
     
+    // A router could not forward a Don't Fragment segment: remember the
+    // smaller path MTU and resend the segment for the router to fragment
+    void handlePacketTooBig(cMessage* msg) {
+        EV_WARN << "DatabaseServer " << addr << " path MTU to " << msg->par("origDst").longValue()
+                << " is " << msg->par("mtu").longValue() << " (router " << SRC(msg) << ")\n";
+        cPacket* resend = paths.packetTooBig(msg, txQueue);
+        pool.release(msg);
+        if (resend) sendPacketOnGate(resend);
+    }
+    
     void startTransmission(cMessage* msg) {
         cGate* outGate = gate("ppp$o");
+        msg = gso.next(msg, txQueue, pool);
         send(msg, outGate);
         
         // Schedule end of transmission
         cChannel* channel = outGate->getTransmissionChannel();
         simtime_t finishTime = channel->getTransmissionFinishTime();
         
-        if (endTxEvent == nullptr) {
-            endTxEvent = new cMessage("endTx");
-        } else {
-            // Cancel if already scheduled
-            if (endTxEvent->isScheduled()) {
-                cancelEvent(endTxEvent);
-            }
+        if (endTxEvent->isScheduled()) {
+            cancelEvent(endTxEvent);
         }
         scheduleAt(finishTime, endTxEvent);
         EV_INFO << "DB" << addr << " started transmission of " << msg->getName() << ", finish at " << finishTime << "\n";
@@ -165,38 +202,78 @@ class DatabaseServer : public cSimpleModule {
     void handleKeyExchange(cMessage* msg) {
         long peerAddr = SRC(msg);
         string peerPublicKey = msg->par("publicKey").stringValue();
+        bool isResponse = msg->hasPar("response") && msg->par("response").boolValue();
         
-        string sharedSecret = computeSharedSecret(myPrivateKey, peerPublicKey);
-        sharedKeys[peerAddr] = sharedSecret;
-        
-        if (sharedKeys.find(peerAddr) == sharedKeys.end() || sharedKeys[peerAddr].empty()) {
+        // Answer handshakes initiated by the peer
+        if (!isResponse) {
+            cryptoCost.chargeEcdh();  // Ephemeral key pair for the response
             auto* response = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, peerAddr);
-            response->addPar("publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "response").setBoolValue(true);
             response->par("priority").setLongValue(PRIORITY_HIGH);
             sendPacketOnGate(response);
         }
         
-        sharedKeys[peerAddr] = sharedSecret;
+        // Compute shared secret only when the peer presents a new public key
+        PeerState& peer = peers.get(peerAddr);
+        if (!peer.hasKey() || peer.peerPublicKey != peerPublicKey) {
+            peer.key = computeSharedSecret(myPrivateKey, peerPublicKey);
+            cryptoCost.chargeEcdh();
+            peer.peerPublicKey = peerPublicKey;
+            sendSessionTicket(peer);
+        }
+        
         EV_INFO << "DatabaseServer " << addr << " key exchange with " << peerAddr << "\n";
-        delete msg;
+        pool.release(msg);
+    }
+    
+    void sendSessionTicket(const PeerState& peer) {
+        auto* ticket = mk("SESSION_TICKET", SESSION_TICKET, addr, peer.addr);
+        pool.addPar(ticket, "ticket").setStringValue(tickets.issue(peer.addr, peer.key).c_str());
+        pool.addPar(ticket, "lifetime").setDoubleValue(tickets.lifetime.dbl());
+        ticket->par("priority").setLongValue(PRIORITY_HIGH);
+        sendPacketOnGate(ticket);
+    }
+    
+    // 0-RTT data: on a rejected ticket only the early data is dropped, and
+    // a full handshake replaces the session key
+    bool acceptEarlyData(cMessage* msg) {
+        long src = SRC(msg);
+        cryptoCost.chargeCipher(strlen(msg->par("ticket").stringValue()) / 2);
+        CipherKey earlyKey;
+        if (!tickets.redeem(msg, earlyKey)) {
+            EV_WARN << "DatabaseServer " << addr << " rejected 0-RTT data from " << src << "\n";
+            auto* keyMsg = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, src);
+            pool.addPar(keyMsg, "publicKey").setStringValue(myPublicKey.c_str());
+            keyMsg->par("priority").setLongValue(PRIORITY_HIGH);
+            sendPacketOnGate(keyMsg);
+            return false;
+        }
+        PeerState& peer = peers.get(src);
+        peer.key = earlyKey;
+        peer.peerPublicKey.clear();
+        sendSessionTicket(peer);
+        EV_INFO << "DatabaseServer " << addr << " accepted 0-RTT data from " << src << "\n";
+        return true;
     }
     
     void handleTCPSyn(cMessage* msg) {
         long src = SRC(msg);
         long seq = SEQ(msg);
         
-        synCounts[src]++;
-        synTimestamps[src] = simTime();
+        PeerState& peer = peers.get(src);
+        peer.synCount++;
+        peer.synTimestamp = simTime();
         
-        if (synCounts[src] > synRateLimit) {
+        if (peer.synCount > synRateLimit) {
             EV_WARN << "DatabaseServer " << addr << " SYN flood from " << src << "\n";
-            delete msg;
+            pool.release(msg);
             return;
         }
         
         long cookie = msg->par("synCookie").longValue();
         if (!validateSYNCookie(cookie, src, addr, seq)) {
-            delete msg;
+            pool.release(msg);
             return;
         }
         
@@ -205,7 +282,7 @@ class DatabaseServer : public cSimpleModule {
         synAck->par("seq").setLongValue(serverSeq);
         synAck->par("ack").setLongValue(seq + 1);
         synAck->par("priority").setLongValue(PRIORITY_HIGH);
-        synAck->addPar("synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
+        pool.addPar(synAck, "synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
         sendPacketOnGate(synAck);
         
         TCPConnection conn;
@@ -215,28 +292,27 @@ class DatabaseServer : public cSimpleModule {
         conn.recvSeq = seq + 1;
         conn.cwnd = 2.0;  // Database: higher initial window
         conn.ssthresh = 128.0;
-        tcpConnections[src] = conn;
-        
-        cwndMap[src] = 2.0;
+        peer.tcp = conn;
         
         EV_INFO << "DatabaseServer " << addr << " SYN-ACK to " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPAck(cMessage* msg) {
         long src = SRC(msg);
         
-        auto it = tcpConnections.find(src);
-        if (it != tcpConnections.end()) {
-            if (it->second.state == TCP_SYN_RECEIVED) {
-                it->second.state = TCP_ESTABLISHED;
+        PeerState* peer = peers.find(src);
+        if (peer && peer->hasConnection()) {
+            TCPConnection& conn = peer->tcp;
+            if (conn.state == TCP_SYN_RECEIVED) {
+                conn.state = TCP_ESTABLISHED;
                 EV_INFO << "DatabaseServer " << addr << " connection established with " << src << "\n";
             }
             
             // Update congestion window
-            cwndMap[src] += 1.0 / cwndMap[src];
+            conn.cwnd += 1.0 / conn.cwnd;
         }
-        delete msg;
+        pool.release(msg);
     }
     
     void handleDatabaseQuery(cMessage* msg) {
@@ -244,33 +320,40 @@ class DatabaseServer : public cSimpleModule {
         bool isEncrypted = msg->hasPar("encrypted") && msg->par("encrypted").boolValue();
         int priority = PRIORITY(msg);
         
+        if (isEncrypted) {
+            cryptoCost.chargeCipher(payloadBytes(msg));
+        }
+        
         // Track active transactions
-        activeTransactions[src]++;
+        PeerState& peer = peers.get(src);
+        peer.activeTransactions++;
         
         EV_INFO << "DatabaseServer " << addr << " query from " << src;
         if (isEncrypted) EV_INFO << " (encrypted)";
-        EV_INFO << " [transaction #" << activeTransactions[src] << "]\n";
+        EV_INFO << " [transaction #" << peer.activeTransactions << "]\n";
         
         // Prepare database response
         auto* resp = mk("DB_RESPONSE", TCP_DATA, addr, src);
-        resp->addPar("bytes").setLongValue(par("responseBytes").intValue());
+        pool.addPar(resp, "bytes").setLongValue(par("responseBytes").intValue());
         resp->par("priority").setLongValue(priority);
-        resp->addPar("transactionId").setLongValue(activeTransactions[src]);
+        gso.offload(resp, pool);
+        paths.mark(resp, pool);
+        pool.addPar(resp, "transactionId").setLongValue(peer.activeTransactions);
         
         // Encrypt response if we have shared key
-        if (sharedKeys.find(src) != sharedKeys.end()) {
+        if (peer.hasKey()) {
             string dbData = "DATABASE_QUERY_RESULT";
-            string encrypted = simpleEncrypt(dbData, sharedKeys[src]);
-            resp->addPar("encData").setStringValue(encrypted.c_str());
-            resp->addPar("encrypted").setBoolValue(true);
+            string encrypted = simpleEncrypt(dbData, peer.key);
+            cryptoCost.chargeCipher(payloadBytes(resp));
+            setPayload(pool.addPar(resp, "encData"), encrypted);
+            pool.addPar(resp, "encrypted").setBoolValue(true);
         }
         
         // Set TCP sequence numbers
-        auto it = tcpConnections.find(src);
-        if (it != tcpConnections.end()) {
-            resp->par("seq").setLongValue(it->second.sendSeq);
-            resp->par("ack").setLongValue(it->second.recvSeq);
-            it->second.sendSeq++;
+        if (peer.hasConnection()) {
+            resp->par("seq").setLongValue(peer.tcp.sendSeq);
+            resp->par("ack").setLongValue(peer.tcp.recvSeq);
+            peer.tcp.sendSeq += gso.segmentCount(resp);
         }
         
         // Priority-based query processing
@@ -278,7 +361,6 @@ class DatabaseServer : public cSimpleModule {
         if (priority >= PRIORITY_HIGH) {
             // Critical queries: immediate processing
             scheduleAt(simTime() + (queryTime * 0.5), resp);
-            sendPacketOnGate(resp);
             EV_INFO << "DatabaseServer " << addr << " high-priority query\n";
         } else {
             // Normal queries: queue
@@ -288,7 +370,7 @@ class DatabaseServer : public cSimpleModule {
             }
         }
         
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPFin(cMessage* msg) {
@@ -300,22 +382,30 @@ class DatabaseServer : public cSimpleModule {
         sendPacketOnGate(finAck);
         
         // Clean up connection state
-        tcpConnections.erase(src);
-        cwndMap.erase(src);
-        activeTransactions.erase(src);
+        if (PeerState* peer = peers.find(src)) {
+            peers.closeConnection(*peer);
+            peer->activeTransactions = 0;
+        }
         
         EV_INFO << "DatabaseServer " << addr << " closed connection with " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void finish() override {
         cancelAndDelete(synFloodCheckTimer);
+        
+        tickets.recordScalars(this);
+        cryptoCost.recordScalars(this);
+        cancelAndDelete(cryptoTimer);
+        cryptoCost.clear();
+        pool.recordScalars(this);
+        peers.recordScalars(this);
+        gso.recordScalars(this);
+        paths.recordScalars(this);
         cancelAndDelete(processQueryTimer);
         
         // Clean up transmission queue
-        if (endTxEvent != nullptr) {
-            cancelAndDelete(endTxEvent);
-        }
+        cancelAndDelete(endTxEvent);
         while (!txQueue.isEmpty()) {
             delete txQueue.pop();
         }
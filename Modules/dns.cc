@@ -12,28 +12,36 @@ class DNS : public cSimpleModule {
     int addr = 0;
     int answer = 3; // HTTP server address
     
+    // Per-peer TCP, key and SYN tracking state
+    PeerTable peers;
+    
     // Security
-    map<long, string> sharedKeys;
+    CryptoCostModel cryptoCost;          // CPU time charged for crypto work
+    cMessage* cryptoTimer;               // CPU free again: held packets go out
     string myPublicKey;
     string myPrivateKey;
     
+    // Session resumption (0-RTT)
+    SessionTicketIssuer tickets;
+    
     // SYN flood protection & rate limiting
-    map<long, int> requestCounts;
-    map<long, simtime_t> lastRequestTime;
     double rateLimit;
     cMessage* rateLimitResetTimer;
     
-    // TCP connections
-    map<long, TCPConnection> tcpConnections;
-    
     // Priority queue for handling requests
     priority_queue<cMessage*, vector<cMessage*>, MessagePriorityCompare> requestQueue;
     
     // Transmission queue management
     cQueue txQueue;
     cMessage* endTxEvent;
+    PacketPool pool;         // Recycled packets, see mk() and pool.release()
     
   protected:
+    // Pooled packet factory; shadows the global mk() inside this module
+    cPacket* mk(const char* name, int kind, long src, long dst) {
+        return pool.get(name, kind, src, dst);
+    }
+    
     void initialize() override {
         addr   = par("address");
         answer = par("answerAddr");
@@ -41,14 +49,18 @@ class DNS : public cSimpleModule {
         
         // Initialize security
         myPrivateKey = generateECDHPublicKey(addr);
-        myPublicKey = generateECDHPublicKey(addr * 2);
+        myPublicKey = deriveECDHPublicKey(myPrivateKey);
+        cryptoCost.configure(this);
+        cryptoTimer = new cMessage("crypto");
+        peers.configure(this);
+        tickets.configure(this, myPrivateKey);
         
         rateLimitResetTimer = new cMessage("rateLimitReset");
         scheduleAt(simTime() + 1.0, rateLimitResetTimer);
         
         // Initialize transmission queue
         txQueue.setName("txQueue");
-        endTxEvent = nullptr;
+        endTxEvent = new cMessage("endTx");
         
         EV_INFO << "DNS server " << addr << " initialized with rate limit " << rateLimit << "\n";
     }
@@ -56,15 +68,19 @@ class DNS : public cSimpleModule {
     void handleMessage(cMessage *msg) override {
         if (msg->isSelfMessage()) {
             if (msg == rateLimitResetTimer) {
-                requestCounts.clear();
+                peers.forEach([](PeerState& peer) { peer.requestCount = 0; });
+                tickets.prune();
+                peers.age();
                 scheduleAt(simTime() + 1.0, rateLimitResetTimer);
             } else if (msg == endTxEvent) {
                 // Transmission finished, send next packet if available
-                endTxEvent = nullptr;
                 if (!txQueue.isEmpty()) {
                     cMessage* nextMsg = (cMessage*)txQueue.pop();
                     startTransmission(nextMsg);
                 }
+            } else if (msg == cryptoTimer) {
+                cryptoCost.release([&](cMessage* held) { sendPacketOnGate(held); });
+                if (cryptoCost.hasHeld()) scheduleAt(cryptoCost.busyUntil, cryptoTimer);
             }
             return;
         }
@@ -73,10 +89,16 @@ class DNS : public cSimpleModule {
         long src = SRC(msg);
         
         // Rate limiting check
-        requestCounts[src]++;
-        if (requestCounts[src] > rateLimit) {
+        PeerState& peer = peers.get(src);
+        if (++peer.requestCount > rateLimit) {
             EV_WARN << "DNS " << addr << " rate limit exceeded for " << src << ", dropping request\n";
-            delete msg;
+            pool.release(msg);
+            return;
+        }
+        
+        // 0-RTT data carries a resumption ticket instead of a fresh handshake
+        if (msg->hasPar("ticket") && !acceptEarlyData(msg)) {
+            pool.release(msg);
             return;
         }
         
@@ -98,12 +120,18 @@ class DNS : public cSimpleModule {
                 break;
             default:
                 EV_WARN << "DNS unexpected kind=" << kind << "\n";
-                delete msg;
+                pool.release(msg);
         }
     }
     
     // Transmission queue management functions
     void sendPacketOnGate(cMessage* msg) {
+        // Hold the packet until the CPU has finished pending crypto work
+        if (cryptoCost.hold(msg)) {
+            if (!cryptoTimer->isScheduled()) scheduleAt(max(simTime(), cryptoCost.busyUntil), cryptoTimer);
+            return;
+        }
+        
         cGate* outGate = gate("ppp$o");
         
         // Check if channel is busy
@@ -112,7 +140,7 @@ class DNS : public cSimpleModule {
             // Channel busy, queue the packet
             txQueue.insert(msg);
             EV_INFO << "DNS" << addr << " channel busy, queued packet " << msg->getName() << "\n";
-        } else if (endTxEvent != nullptr) {
+        } else if (endTxEvent->isScheduled()) {
             // Already transmitting, queue the packet
             txQueue.insert(msg);
             EV_INFO << "DNS" << addr << " transmission in progress, queued packet " << msg->getName() << "\n";
@@ -130,13 +158,8 @@ class DNS : public cSimpleModule {
         cChannel* channel = outGate->getTransmissionChannel();
         simtime_t finishTime = channel->getTransmissionFinishTime();
         
-        if (endTxEvent == nullptr) {
-            endTxEvent = new cMessage("endTx");
-        } else {
-            // Cancel if already scheduled
-            if (endTxEvent->isScheduled()) {
-                cancelEvent(endTxEvent);
-            }
+        if (endTxEvent->isScheduled()) {
+            cancelEvent(endTxEvent);
         }
         scheduleAt(finishTime, endTxEvent);
         EV_INFO << "DNS" << addr << " started transmission of " << msg->getName() << ", finish at " << finishTime << "\n";
@@ -145,23 +168,59 @@ class DNS : public cSimpleModule {
     void handleKeyExchange(cMessage* msg) {
         long peerAddr = SRC(msg);
         string peerPublicKey = msg->par("publicKey").stringValue();
+        bool isResponse = msg->hasPar("response") && msg->par("response").boolValue();
         
-        // Compute shared secret
-        string sharedSecret = computeSharedSecret(myPrivateKey, peerPublicKey);
-        sharedKeys[peerAddr] = sharedSecret;
-        
-        // If this is a request (no shared key yet), send our public key
-        if (sharedKeys.find(peerAddr) == sharedKeys.end() || 
-            sharedKeys[peerAddr].empty()) {
+        // Answer handshakes initiated by the peer
+        if (!isResponse) {
+            cryptoCost.chargeEcdh();  // Ephemeral key pair for the response
             auto* response = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, peerAddr);
-            response->addPar("publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "response").setBoolValue(true);
             response->par("priority").setLongValue(PRIORITY_HIGH);
             sendPacketOnGate(response);
         }
         
-        sharedKeys[peerAddr] = sharedSecret;
+        // Compute shared secret only when the peer presents a new public key
+        PeerState& peer = peers.get(peerAddr);
+        if (!peer.hasKey() || peer.peerPublicKey != peerPublicKey) {
+            peer.key = computeSharedSecret(myPrivateKey, peerPublicKey);
+            cryptoCost.chargeEcdh();
+            peer.peerPublicKey = peerPublicKey;
+            sendSessionTicket(peer);
+        }
+        
         EV_INFO << "DNS " << addr << " completed key exchange with " << peerAddr << "\n";
-        delete msg;
+        pool.release(msg);
+    }
+    
+    void sendSessionTicket(const PeerState& peer) {
+        auto* ticket = mk("SESSION_TICKET", SESSION_TICKET, addr, peer.addr);
+        pool.addPar(ticket, "ticket").setStringValue(tickets.issue(peer.addr, peer.key).c_str());
+        pool.addPar(ticket, "lifetime").setDoubleValue(tickets.lifetime.dbl());
+        ticket->par("priority").setLongValue(PRIORITY_HIGH);
+        sendPacketOnGate(ticket);
+    }
+    
+    // 0-RTT data: on a rejected ticket only the early data is dropped, and
+    // a full handshake replaces the session key
+    bool acceptEarlyData(cMessage* msg) {
+        long src = SRC(msg);
+        cryptoCost.chargeCipher(strlen(msg->par("ticket").stringValue()) / 2);
+        CipherKey earlyKey;
+        if (!tickets.redeem(msg, earlyKey)) {
+            EV_WARN << "DNS " << addr << " rejected 0-RTT data from " << src << "\n";
+            auto* keyMsg = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, src);
+            pool.addPar(keyMsg, "publicKey").setStringValue(myPublicKey.c_str());
+            keyMsg->par("priority").setLongValue(PRIORITY_HIGH);
+            sendPacketOnGate(keyMsg);
+            return false;
+        }
+        PeerState& peer = peers.get(src);
+        peer.key = earlyKey;
+        peer.peerPublicKey.clear();
+        sendSessionTicket(peer);
+        EV_INFO << "DNS " << addr << " accepted 0-RTT data from " << src << "\n";
+        return true;
     }
     
     void handleTCPSyn(cMessage* msg) {
@@ -172,7 +231,7 @@ class DNS : public cSimpleModule {
         // Validate SYN cookie (protection against SYN flooding)
         if (!validateSYNCookie(cookie, src, addr, seq)) {
             EV_WARN << "DNS " << addr << " invalid SYN cookie from " << src << "\n";
-            delete msg;
+            pool.release(msg);
             return;
         }
         
@@ -182,7 +241,7 @@ class DNS : public cSimpleModule {
         synAck->par("seq").setLongValue(serverSeq);
         synAck->par("ack").setLongValue(seq + 1);
         synAck->par("priority").setLongValue(PRIORITY_HIGH);
-        synAck->addPar("synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
+        pool.addPar(synAck, "synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
         sendPacketOnGate(synAck);
         
         // Create TCP connection
@@ -191,21 +250,21 @@ class DNS : public cSimpleModule {
         conn.state = TCP_SYN_RECEIVED;
         conn.sendSeq = serverSeq + 1;
         conn.recvSeq = seq + 1;
-        tcpConnections[src] = conn;
+        peers.get(src).tcp = conn;
         
         EV_INFO << "DNS " << addr << " sent SYN-ACK to " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPAck(cMessage* msg) {
         long src = SRC(msg);
         
-        auto it = tcpConnections.find(src);
-        if (it != tcpConnections.end() && it->second.state == TCP_SYN_RECEIVED) {
-            it->second.state = TCP_ESTABLISHED;
+        PeerState* peer = peers.find(src);
+        if (peer && peer->tcp.state == TCP_SYN_RECEIVED) {
+            peer->tcp.state = TCP_ESTABLISHED;
             EV_INFO << "DNS " << addr << " TCP connection established with " << src << "\n";
         }
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPData(cMessage* msg) {
@@ -213,7 +272,7 @@ class DNS : public cSimpleModule {
         if (msg->hasPar("qname")) {
             handleDNSQuery(msg);
         } else {
-            delete msg;
+            pool.release(msg);
         }
     }
     
@@ -223,10 +282,12 @@ class DNS : public cSimpleModule {
         bool isEncrypted = msg->hasPar("encrypted") && msg->par("encrypted").boolValue();
         bool isUDP = msg->hasPar("protocol") && 
                      string(msg->par("protocol").stringValue()) == "UDP";
+        PeerState& peer = peers.get(src);
         
         // Decrypt if encrypted
-        if (isEncrypted && sharedKeys.find(src) != sharedKeys.end()) {
-            qname = simpleDecrypt(qname, sharedKeys[src]);
+        if (isEncrypted && peer.hasKey()) {
+            qname = simpleDecrypt(qname, peer.key);
+            cryptoCost.chargeCipher(payloadBytes(msg));
         }
         
         EV_INFO << "DNS " << addr << " received query for '" << qname << "' from " << src;
@@ -237,14 +298,15 @@ class DNS : public cSimpleModule {
         // Create response
         int responseKind = isUDP ? UDP_DATA : (msg->getKind() == TCP_DATA ? TCP_DATA : DNS_RESPONSE);
         auto *resp = mk("DNS_RESPONSE", responseKind, addr, src);
-        resp->addPar("qname").setStringValue(qname.c_str());
-        resp->addPar("answer").setLongValue(answer);
+        pool.addPar(resp, "qname").setStringValue(qname.c_str());
+        pool.addPar(resp, "answer").setLongValue(answer);
         
         // Encrypt response if we have shared key
-        if (sharedKeys.find(src) != sharedKeys.end()) {
-            string encryptedQname = simpleEncrypt(qname, sharedKeys[src]);
+        if (peer.hasKey()) {
+            string encryptedQname = simpleEncrypt(qname, peer.key);
+            cryptoCost.chargeCipher(payloadBytes(resp));
             resp->par("qname").setStringValue(encryptedQname.c_str());
-            resp->addPar("encrypted").setBoolValue(true);
+            pool.addPar(resp, "encrypted").setBoolValue(true);
         }
         
         // Set priority based on request priority
@@ -252,26 +314,30 @@ class DNS : public cSimpleModule {
         
         // For TCP, set sequence numbers
         if (responseKind == TCP_DATA) {
-            auto it = tcpConnections.find(src);
-            if (it != tcpConnections.end()) {
-                resp->par("seq").setLongValue(it->second.sendSeq);
-                resp->par("ack").setLongValue(it->second.recvSeq);
-                it->second.sendSeq++;
+            if (peer.hasConnection()) {
+                resp->par("seq").setLongValue(peer.tcp.sendSeq);
+                resp->par("ack").setLongValue(peer.tcp.recvSeq);
+                peer.tcp.sendSeq++;
             }
         }
         
         sendPacketOnGate(resp);
         EV_INFO << "DNS " << addr << " sent response to " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void finish() override {
         cancelAndDelete(rateLimitResetTimer);
         
+        tickets.recordScalars(this);
+        cryptoCost.recordScalars(this);
+        cancelAndDelete(cryptoTimer);
+        cryptoCost.clear();
+        pool.recordScalars(this);
+        peers.recordScalars(this);
+        
         // Clean up transmission queue
-        if (endTxEvent != nullptr) {
-            cancelAndDelete(endTxEvent);
-        }
+        cancelAndDelete(endTxEvent);
         while (!txQueue.isEmpty()) {
             delete txQueue.pop();
         }
@@ -9,6 +9,13 @@
 #include <cmath>
 #include <algorithm>
 #include <queue>
+#include <deque>
+#include <cstdlib>
+#include <cstdint>
+#include <climits>
+#include <memory>
+#include <functional>
+#include "crypto.h"
 using namespace omnetpp;
 using namespace std;
 
@@ -28,6 +35,7 @@ Message kinds:
   // Security Messages
   50 = KEY_EXCHANGE     // ECDH key exchange
   51 = ENCRYPTED_DATA   // AES encrypted data
+  52 = SESSION_TICKET   // Resumption ticket issued after a full handshake
   
   // DNS Messages (Enhanced)
   10 = DNS_QUERY
@@ -43,6 +51,18 @@ Message kinds:
   62 = OSPF_TE_UPDATE   // OSPF Traffic Engineering update
   63 = RIP_UPDATE       // RIP distance vector update
   64 = RIP_REQUEST      // RIP route request
+  65 = BFD_CONTROL      // BFD liveness between adjacent routers ("bfdState": sender's session state)
+  70 = BGP_UPDATE       // BGP path-vector announcements and withdrawals
+  71 = BGP_KEEPALIVE    // BGP session liveness (also brings the session up)
+  
+  // Video Streaming Messages
+  82 = VIDEO_REQUEST    // Request one video segment at a chosen bitrate
+  83 = VIDEO_CHUNK      // One packet of a video segment
+  
+  // Network Errors (sent by routers back to the packet's source)
+  90 = DEST_UNREACHABLE // No route to the destination
+  91 = TIME_EXCEEDED    // Hop limit reached zero in transit
+  92 = PACKET_TOO_BIG   // Don't Fragment packet larger than the next link's MTU
 
 For all messages we set:
   par("src") : long  logical sender address
@@ -50,18 +70,65 @@ For all messages we set:
   par("seq") : long  sequence number (for TCP)
   par("ack") : long  acknowledgment number (for TCP)
   par("priority") : int (0=low, 1=normal, 2=high, 3=critical)
+  par("ttl") : int   hop limit, DEFAULT_TTL at creation, decremented by each router
   par("protocol") : string ("TCP" or "UDP")
   
 Security parameters:
   par("publicKey") : string  ECDH public key (hex string)
-  par("encData") : string    AES encrypted payload (hex string)
+  par("encData") : payload   Encrypted payload (PayloadChunk, see getPayload())
   par("iv") : string         AES initialization vector
+  par("response") : bool     KEY_EXCHANGE answers an earlier KEY_EXCHANGE
+  par("ticket") : string     Session ticket (hex) presented with 0-RTT data
+  par("ticketNonce") : string  Per-use nonce for deriving the 0-RTT key
   
 Routing parameters:
   par("metric") : double     Route metric/cost
   par("bandwidth") : double  Available bandwidth (Mbps)
   par("delay") : double      Link delay (ms)
   par("hopCount") : int      Number of hops
+  par("linkId") : long       OSPF LSA: advertising router's gate
+  par("neighbor") : long     OSPF LSA: address at the far end of the link
+  par("transit") : bool      OSPF LSA: the far end is a router
+  par("lsaSeq") : long       OSPF LSA: advertising router's LSA round
+  par("down") : bool         OSPF LSA: the link's adjacency is down; withdraws the link
+  par("routes") : payload    RIP distance vector "dest:metric:hops,..." (PayloadChunk)
+                             BGP announcements "prefix|localPref|med|originator|asPath|clusters;..."
+  par("withdrawn") : payload BGP withdrawn prefixes "prefix,..." (PayloadChunk)
+  par("asNumber") : long     BGP speaker's autonomous system
+  
+Segmentation offload:
+  par("segOffset") : long    Payload bytes of the offloaded send before this segment;
+                             "bytes" is the whole send, the segment is getByteLength() - HEADER_BYTES
+  par("segSize") : long      Payload bytes per wire segment, fixed when the send is offloaded
+  
+ECN:
+  par("ecn") : long          ECN_ECT from an ECN-capable sender; routers change it to ECN_CE
+                             instead of letting the egress queue grow (see ecnThreshold)
+  par("ecnEcho") : long      ACKs to an ECN-capable sender: CE-marked segments received from it
+                             so far (a cumulative count, so coalesced ACKs lose no marks)
+  
+Fragmentation:
+  par("df") : bool           Don't Fragment: routers answer PACKET_TOO_BIG instead (path MTU discovery)
+  par("fragId") : long       Datagram id, unique per fragmenting router; with "src" keys reassembly
+  par("fragOffset") : long   Payload bytes of the datagram before this fragment
+  par("fragBytes") : long    Wire length of the whole datagram; a fragment carries
+                             getByteLength() - IP_HEADER_BYTES of its payload
+  
+Error parameters:
+  par("origDst") : long      DEST_UNREACHABLE/TIME_EXCEEDED/PACKET_TOO_BIG: destination of the dropped packet
+  par("origKind") : long     Kind of the dropped packet (its seq is copied to "seq")
+  par("mtu") : long          PACKET_TOO_BIG: MTU of the link the packet did not fit
+  par("origBytes") : long    PACKET_TOO_BIG: length of the dropped packet, which is encapsulated
+                             cut to HEADER_BYTES
+  
+Video parameters:
+  par("segment") : long      Segment index (VIDEO_REQUEST, VIDEO_CHUNK, video ACKs)
+  par("request") : long      Client's attempt id for the segment (VIDEO_REQUEST, VIDEO_CHUNK,
+                             video ACKs); chunks and ACKs of another attempt are ignored
+  par("bytes") : long        VIDEO_REQUEST: segment size to send; VIDEO_CHUNK: bytes of the burst
+  par("chunks") : long       VIDEO_CHUNK: chunks in the segment (the chunk index is "seq")
+  par("protocol") : string   VIDEO_REQUEST: "TCP" (windowed, ACKed) or "UDP" (paced by the link)
+  par("ack") : long          Video ACK: index of the next chunk expected in order
 */
 
 enum {
@@ -74,16 +141,18 @@ enum {
     // UDP
     UDP_DATA=40,
     // Security
-    KEY_EXCHANGE=50, ENCRYPTED_DATA=51,
+    KEY_EXCHANGE=50, ENCRYPTED_DATA=51, SESSION_TICKET=52,
     // Routing
     OSPF_HELLO=60, OSPF_LSA=61, OSPF_TE_UPDATE=62,
-    RIP_UPDATE=63, RIP_REQUEST=64,
+    RIP_UPDATE=63, RIP_REQUEST=64, BFD_CONTROL=65,
     // BGP
     BGP_UPDATE=70, BGP_KEEPALIVE=71,
     // Application layer
     MAIL_REQUEST=80, MAIL_RESPONSE=81,
     VIDEO_REQUEST=82, VIDEO_CHUNK=83,
-    DB_QUERY=84, DB_RESPONSE=85
+    DB_QUERY=84, DB_RESPONSE=85,
+    // Network errors
+    DEST_UNREACHABLE=90, TIME_EXCEEDED=91, PACKET_TOO_BIG=92
 };
 
 // Priority levels for traffic management
@@ -94,6 +163,9 @@ enum Priority {
     PRIORITY_CRITICAL = 3
 };
 
+// Initial hop limit of every packet
+static const int DEFAULT_TTL = 64;
+
 // Connection states for TCP
 enum TCPState {
     TCP_CLOSED,
@@ -125,15 +197,35 @@ struct RouteEntry {
 struct LinkState {
     long routerId;
     int linkId;
+    long neighbor;         // Address at the far end, -1 if unknown
+    bool transit;          // Far end is a router, so paths continue past it
+    bool down;             // Adjacency down: the origin withdrew the link
+    long seq;              // Origin's LSA round; older copies are not re-flooded
     double cost;
     double bandwidth;
     double delay;
     simtime_t timestamp;
     
-    LinkState() : routerId(0), linkId(-1), cost(1.0), 
+    LinkState() : routerId(0), linkId(-1), neighbor(-1), transit(false), down(false), seq(0), cost(1.0), 
                   bandwidth(100.0), delay(1.0), timestamp(0) {}
 };
 
+// BGP route for one prefix, as learned from a peer or originated locally
+struct BGPRoute {
+    long prefix;
+    vector<long> asPath;       // Nearest AS first; empty for routes from our own AS
+    long localPref;
+    long med;
+    long originatorId;         // Route reflection: router that injected it into iBGP (0 = unset)
+    vector<long> clusterList;  // Route reflection: reflectors it passed through
+    int peerGate;              // Session it was learned on (-1 = originated here)
+    long peerRouterId;
+    bool ibgp;
+    
+    BGPRoute() : prefix(0), localPref(100), med(0), originatorId(0),
+                 peerGate(-1), peerRouterId(0), ibgp(false) {}
+};
+
 // Connection tracking for TCP
 struct TCPConnection {
     long remoteAddr;
@@ -163,39 +255,632 @@ static bool validateSYNCookie(long cookie, long src, long dst, long seq) {
     return (cookie & 0xFFFFFF) == (expected & 0xFFFFFF);
 }
 
-// Simple AES simulation (placeholder - in production use real crypto library)
-static string simpleEncrypt(const string& data, const string& key) {
-    string encrypted;
-    for (size_t i = 0; i < data.length(); i++) {
-        encrypted += (char)(data[i] ^ key[i % key.length()] ^ 0xAA);
-    }
-    return encrypted;
-}
+// Session resumption (TLS 1.3 style tickets, simplified)
+struct SessionTicket {
+    string ticket;            // Opaque blob sealed under the server's ticket key
+    string resumptionSecret;  // Secret shared with the issuing server
+    simtime_t issued;
+    simtime_t lifetime;
 
-static string simpleDecrypt(const string& data, const string& key) {
-    return simpleEncrypt(data, key); // XOR is symmetric
-}
+    SessionTicket() : issued(0), lifetime(0) {}
+};
 
-// ECDH key exchange simulation (simplified)
-static string generateECDHPublicKey(long address) {
-    // Simplified: just generate a pseudo-key based on address
+static string sealSessionTicket(const CipherKey& ticketKey, long clientAddr,
+                                const string& resumptionSecret, simtime_t issued) {
     stringstream ss;
-    ss << hex << (address * 0x12345 + 0x6789ABCD);
-    return ss.str();
+    ss << clientAddr << ":" << issued.dbl() << ":" << toHex(resumptionSecret);
+    return toHex(simpleEncrypt(ss.str(), ticketKey));
 }
 
-static string computeSharedSecret(const string& myPrivate, const string& theirPublic) {
-    // Simplified: combine keys
-    stringstream ss;
-    ss << myPrivate << theirPublic;
-    string combined = ss.str();
-    string secret;
-    for (size_t i = 0; i < 16; i++) { // 128-bit key
-        secret += (char)((combined[i % combined.length()] ^ 0x5A) + i);
+static bool openSessionTicket(const CipherKey& ticketKey, const string& ticket,
+                              long& clientAddr, string& resumptionSecret, simtime_t& issued) {
+    string plain = simpleDecrypt(fromHex(ticket), ticketKey);
+    double issuedAt = 0;
+    char secretHex[128];
+    if (sscanf(plain.c_str(), "%ld:%lf:%127s", &clientAddr, &issuedAt, secretHex) != 3) {
+        return false;
     }
-    return secret;
+    resumptionSecret = fromHex(secretHex);
+    issued = issuedAt;
+    return resumptionSecret.size() == 16;
 }
 
+// Server side of session resumption: issues tickets sealed under the
+// server's ticket key and redeems them for 0-RTT data. Tickets are
+// single-use; consumed ones are remembered until they expire.
+class SessionTicketIssuer {
+  private:
+    CipherKey ticketKey;
+    map<string, simtime_t> used;  // Anti-replay: consumed ticket -> expiry
+    
+  public:
+    simtime_t lifetime;
+    long issued = 0;
+    long accepted = 0;
+    long rejected = 0;
+    
+    void configure(cModule* module, const string& privateKey) {
+        ticketKey = deriveSessionKey(privateKey, "ticket");
+        lifetime = module->par("ticketLifetime");
+    }
+    
+    // Ticket for a client that holds key after a completed handshake
+    string issue(long client, const CipherKey& key) {
+        issued++;
+        return sealSessionTicket(ticketKey, client, deriveSessionKey(key.key, "resumption"), simTime());
+    }
+    
+    // Opens the ticket on 0-RTT data msg. A forged, foreign, expired or
+    // replayed ticket returns false; otherwise the ticket is consumed and
+    // earlyKey is the key the early data is sealed under.
+    bool redeem(cMessage* msg, CipherKey& earlyKey) {
+        string ticket = msg->par("ticket").stringValue();
+        string nonce = msg->hasPar("ticketNonce") ? msg->par("ticketNonce").stringValue() : "";
+        long owner = -1;
+        string resumptionSecret;
+        simtime_t issuedAt;
+        bool valid = openSessionTicket(ticketKey, ticket, owner, resumptionSecret, issuedAt) &&
+                     owner == msg->par("src").longValue() && simTime() - issuedAt <= lifetime &&
+                     used.find(ticket) == used.end();
+        if (!valid) {
+            rejected++;
+            return false;
+        }
+        used[ticket] = issuedAt + lifetime;
+        earlyKey = deriveSessionKey(resumptionSecret, "early:" + nonce);
+        accepted++;
+        return true;
+    }
+    
+    // Forgets consumed tickets that have expired anyway
+    void prune() {
+        for (auto it = used.begin(); it != used.end(); ) {
+            if (it->second < simTime()) {
+                it = used.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("ticketsIssued", issued);
+        module->recordScalar("earlyDataAccepted", accepted);
+        module->recordScalar("earlyDataRejected", rejected);
+    }
+};
+
+// CPU cost of cryptographic work, charged as processing delay at endpoints.
+// Per-operation figures are single-core estimates for common hardware.
+// Packets sent while the CPU is busy are held and leave in send order once
+// it is free; the module arms one crypto timer for busyUntil.
+struct CryptoCostModel {
+    bool enabled;
+    simtime_t ecdhCost;        // One ECDH operation (key generation or agreement)
+    double cipherCostPerByte;  // Bulk AEAD cost in seconds per byte
+    simtime_t cipherCallCost;  // Fixed per-packet cost (nonce, tag, setup)
+    
+    simtime_t busyUntil;       // CPU is occupied until this time
+    simtime_t totalCpuTime;
+    long ecdhOps;
+    long cipherBytes;
+    deque<cMessage*> held;     // Packets waiting for the CPU, oldest first
+    
+    CryptoCostModel() : enabled(false), ecdhCost(0), cipherCostPerByte(0), cipherCallCost(0),
+                        busyUntil(0), totalCpuTime(0), ecdhOps(0), cipherBytes(0) {}
+    ~CryptoCostModel() { clear(); }
+    
+    // Reads cryptoCostModel, cipherImpl, keyExchangeCurve and the optional
+    // ecdhCost / cipherCostPerByte overrides from the module's parameters
+    void configure(cModule* module) {
+        enabled = module->par("cryptoCostModel").boolValue();
+        string cipherImpl = module->par("cipherImpl").stdstringValue();
+        string curve = module->par("keyExchangeCurve").stdstringValue();
+        
+        if (curve == "X25519") {
+            ecdhCost = 50e-6;
+        } else if (curve == "P-256") {
+            ecdhCost = 150e-6;
+        } else {
+            throw cRuntimeError("Unknown keyExchangeCurve '%s'", curve.c_str());
+        }
+        
+        if (cipherImpl == "AES-NI") {
+            cipherCostPerByte = 0.3e-9;   // ~3 GB/s AES-GCM
+            cipherCallCost = 200e-9;
+        } else if (cipherImpl == "SOFTWARE") {
+            cipherCostPerByte = 8e-9;     // ~125 MB/s table-based AES-GCM
+            cipherCallCost = 500e-9;
+        } else {
+            throw cRuntimeError("Unknown cipherImpl '%s'", cipherImpl.c_str());
+        }
+        
+        double ecdhOverride = module->par("ecdhCost").doubleValue();
+        double perByteOverride = module->par("cipherCostPerByte").doubleValue();
+        if (ecdhOverride >= 0) ecdhCost = ecdhOverride;
+        if (perByteOverride >= 0) cipherCostPerByte = perByteOverride;
+    }
+    
+    void charge(simtime_t cost) {
+        if (!enabled || cost <= 0) return;
+        simtime_t now = simTime();
+        busyUntil = (busyUntil > now ? busyUntil : now) + cost;
+        totalCpuTime += cost;
+    }
+    
+    void chargeEcdh() {
+        ecdhOps++;
+        charge(ecdhCost);
+    }
+    
+    void chargeCipher(long bytes) {
+        cipherBytes += bytes;
+        charge(cipherCallCost + cipherCostPerByte * bytes);
+    }
+    
+    bool isBusy() const { return enabled && busyUntil > simTime(); }
+    bool hasHeld() const { return !held.empty(); }
+    
+    // Takes msg when it has to wait: the CPU is busy, or earlier packets
+    // are still held. Arm the crypto timer for busyUntil when hasHeld().
+    bool hold(cMessage* msg) {
+        if (!isBusy() && held.empty()) return false;
+        held.push_back(msg);
+        return true;
+    }
+    
+    // Crypto timer expiry: once the CPU is free, send(msg) is called for
+    // the held packets in order. Re-arm the timer when hasHeld().
+    template <typename Send>
+    void release(Send send) {
+        if (isBusy()) return;  // More work was charged meanwhile
+        deque<cMessage*> due;
+        due.swap(held);
+        for (cMessage* msg : due) send(msg);
+    }
+    
+    void clear() {
+        for (cMessage* msg : held) delete msg;
+        held.clear();
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("cryptoCpuTime", totalCpuTime);
+        module->recordScalar("ecdhOps", ecdhOps);
+        module->recordScalar("cipherBytes", cipherBytes);
+    }
+};
+
+// Adaptive-bitrate decision for segmented video. Throughput samples are
+// per-segment download rates; the buffer level is in seconds of video.
+//   "BOLA"       buffer-based utility maximisation (BOLA-BASIC); like dash.js
+//                it falls back to the throughput rule while the buffer is
+//                below a third of maxBuffer, where BOLA alone stays at the
+//                lowest quality
+//   "MPC"        RobustMPC: enumerate qualities over a 5-segment horizon
+//                against a harmonic-mean throughput discounted by past error
+//   "THROUGHPUT" highest bitrate below 90% of the harmonic-mean throughput
+class AbrController {
+  public:
+    vector<double> bitrates;     // kbps, ascending
+    double segmentDuration = 2;  // seconds
+    double maxBuffer = 30;       // seconds
+    string algorithm = "BOLA";
+    
+    void configure(const string& algo, const string& ladder, double segDur, double maxBuf) {
+        algorithm = algo;
+        segmentDuration = segDur;
+        maxBuffer = maxBuf;
+        bitrates.clear();
+        stringstream ss(ladder);
+        string item;
+        while (getline(ss, item, ',')) {
+            if (!item.empty()) bitrates.push_back(atof(item.c_str()));
+        }
+        sort(bitrates.begin(), bitrates.end());
+        if (bitrates.empty()) bitrates.push_back(1000);
+        samples.clear();
+        errors.clear();
+        lastPrediction = 0;
+    }
+    
+    void addSample(double kbps) {
+        if (lastPrediction > 0) {
+            errors.push_back(fabs(lastPrediction - kbps) / kbps);
+            if (errors.size() > HISTORY) errors.pop_front();
+        }
+        samples.push_back(kbps);
+        if (samples.size() > HISTORY) samples.pop_front();
+    }
+    
+    // Harmonic mean of the recent samples (0 before the first one)
+    double predictThroughput() const {
+        if (samples.empty()) return 0;
+        double inv = 0;
+        for (double s : samples) inv += 1.0 / s;
+        return samples.size() / inv;
+    }
+    
+    // Quality index for the next segment
+    int choose(double bufferLevel, int lastQuality) {
+        lastPrediction = predictThroughput();
+        if (algorithm == "MPC") return chooseMpc(bufferLevel, lastQuality);
+        if (algorithm == "BOLA" && bufferLevel >= maxBuffer / 3) return chooseBola(bufferLevel);
+        return chooseByThroughput(lastPrediction);
+    }
+    
+  private:
+    static const size_t HISTORY = 5;
+    deque<double> samples;
+    deque<double> errors;
+    double lastPrediction = 0;
+    
+    int chooseByThroughput(double kbps) const {
+        int q = 0;
+        for (size_t i = 0; i < bitrates.size(); i++) {
+            if (bitrates[i] <= 0.9 * kbps) q = (int)i;
+        }
+        return q;
+    }
+    
+    int chooseBola(double bufferLevel) const {
+        const double gp = 5.0;  // Playback utility weight (gamma * p)
+        double qMax = max(maxBuffer / segmentDuration, 2.0);
+        double vMax = log(bitrates.back() / bitrates.front());
+        double V = (qMax - 1) / (vMax + gp);
+        double Q = bufferLevel / segmentDuration;
+        int best = 0;
+        double bestScore = -INFINITY;
+        for (size_t m = 0; m < bitrates.size(); m++) {
+            double utility = log(bitrates[m] / bitrates.front());
+            double score = (V * (utility + gp) - Q) / bitrates[m];
+            if (score > bestScore) {
+                bestScore = score;
+                best = (int)m;
+            }
+        }
+        return best;
+    }
+    
+    int chooseMpc(double bufferLevel, int lastQuality) const {
+        double predicted = predictThroughput();
+        if (predicted <= 0) return 0;
+        double maxError = 0;
+        for (double e : errors) maxError = max(maxError, e);
+        double robust = predicted / (1 + maxError);
+        
+        const int horizon = 5;
+        const double rebufferPenalty = bitrates.back() / 1000.0;  // Mbps-equivalent per second stalled
+        int levels = (int)bitrates.size();
+        int prevQuality = lastQuality < 0 ? 0 : lastQuality;
+        
+        // Exhaustive search over quality sequences; levels^horizon stays small
+        vector<int> seq(horizon, 0);
+        double bestQoE = -INFINITY;
+        int bestFirst = 0;
+        while (true) {
+            double buffer = bufferLevel, qoe = 0;
+            int prev = prevQuality;
+            for (int k = 0; k < horizon; k++) {
+                double download = bitrates[seq[k]] * segmentDuration / robust;
+                double stall = max(0.0, download - buffer);
+                buffer = max(0.0, buffer - download) + segmentDuration;
+                qoe += bitrates[seq[k]] / 1000.0 - rebufferPenalty * stall -
+                       fabs(bitrates[seq[k]] - bitrates[prev]) / 1000.0;
+                prev = seq[k];
+            }
+            if (qoe > bestQoE) {
+                bestQoE = qoe;
+                bestFirst = seq[0];
+            }
+            int k = horizon - 1;
+            while (k >= 0 && ++seq[k] == levels) seq[k--] = 0;
+            if (k < 0) break;
+        }
+        return bestFirst;
+    }
+};
+
+// Everything an endpoint tracks about one peer, kept in a single record so
+// a packet costs one lookup. Fields a module does not use keep their defaults.
+struct PeerState {
+    long addr = 0;
+    
+    // Transport: tcp.state is TCP_CLOSED when there is no connection
+    TCPConnection tcp;
+    
+    // Security
+    CipherKey key;               // Empty until a shared key is established
+    string peerPublicKey;        // Public key the shared key was derived from
+    
+    // SYN flood protection / rate limiting
+    int synCount = 0;
+    simtime_t synTimestamp = 0;
+    int requestCount = 0;
+    
+    // Application
+    int activeTransactions = 0;
+    
+    // Client side of session resumption
+    SessionTicket ticket;        // ticket.ticket is empty when none is held
+    string earlyTicket;          // Ticket and nonce presented with pending 0-RTT data
+    string earlyNonce;
+    function<void()> earlyResend; // Repeats the 0-RTT send until the server accepts it
+    
+    simtime_t lastActive = 0;    // Last PeerTable::get()/touch(), drives idle aging
+    
+    // Heap memory held by the record beyond sizeof(PeerState)
+    size_t dynamicBytes() const {
+        return key.key.capacity() + key.schedule.capacity() + peerPublicKey.capacity() +
+               ticket.ticket.capacity() + ticket.resumptionSecret.capacity() +
+               earlyTicket.capacity() + earlyNonce.capacity();
+    }
+    
+    bool hasConnection() const { return tcp.state != TCP_CLOSED && tcp.state != TCP_TIME_WAIT; }
+    bool hasKey() const { return !key.empty(); }
+    bool hasEarlyData() const { return !earlyTicket.empty(); }
+};
+
+// Refers to a PeerTable record without a lookup. The generation tag makes
+// a handle to an erased (and possibly reused) record resolve to nullptr.
+struct PeerHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+// Peer address -> PeerState. Records live in a slab of fixed-size chunks, so
+// references stay valid while other peers are added; the address index is an
+// open-addressing hash table with linear probing.
+//
+// Memory is bounded three ways (see configure()): records are kept in LRU
+// order and the least recently active one is evicted when maxPeers is
+// reached; records idle for longer than peerIdleTimeout are expired; and
+// closed connections sit in TIME_WAIT for timeWaitTimeout before their TCP
+// state is cleared. Call age() periodically to apply the timeouts.
+class PeerTable {
+  private:
+    static const uint32_t CHUNK = 256;
+    static const uint32_t EMPTY = UINT32_MAX;
+    static const uint32_t DELETED = UINT32_MAX - 1;
+    static const uint32_t NONE = UINT32_MAX;
+    
+    struct Slot {
+        PeerState state;
+        uint32_t generation = 0;
+        bool live = false;
+        uint32_t newer = NONE;    // LRU list neighbours
+        uint32_t older = NONE;
+    };
+    struct Bucket {
+        long addr;
+        uint32_t slot;
+    };
+    
+    vector<unique_ptr<Slot[]>> chunks;
+    vector<uint32_t> freeSlots;
+    uint32_t slotCount = 0;
+    vector<Bucket> buckets;       // Size is a power of two
+    size_t live = 0;
+    size_t deleted = 0;
+    uint32_t mru = NONE;          // Most recently active record
+    uint32_t lru = NONE;          // Eviction candidate
+    
+    // Connections waiting out TIME_WAIT, in closing order
+    deque<pair<simtime_t, PeerHandle>> timeWait;
+    
+    size_t maxPeers = 0;          // 0 = unbounded
+    simtime_t idleTimeout = 0;    // 0 = never expire
+    simtime_t timeWaitTimeout = 0;
+    
+    cOutVector peerCountVector;
+    cOutVector memoryVector;
+    
+    static size_t hashAddr(long addr) {
+        uint64_t x = (uint64_t)addr + 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return (size_t)(x ^ (x >> 31));
+    }
+    
+    Slot& slot(uint32_t i) const { return chunks[i / CHUNK][i % CHUNK]; }
+    
+    // Bucket holding addr, or the bucket where it would be inserted
+    size_t probe(long addr) const {
+        size_t mask = buckets.size() - 1;
+        size_t i = hashAddr(addr) & mask;
+        size_t firstDeleted = SIZE_MAX;
+        while (buckets[i].slot != EMPTY) {
+            if (buckets[i].slot == DELETED) {
+                if (firstDeleted == SIZE_MAX) firstDeleted = i;
+            } else if (buckets[i].addr == addr) {
+                return i;
+            }
+            i = (i + 1) & mask;
+        }
+        return firstDeleted != SIZE_MAX ? firstDeleted : i;
+    }
+    
+    void rehash(size_t capacity) {
+        vector<Bucket> old;
+        old.swap(buckets);
+        buckets.assign(capacity, Bucket{0, EMPTY});
+        deleted = 0;
+        for (auto& b : old) {
+            if (b.slot < DELETED) buckets[probe(b.addr)] = b;
+        }
+    }
+    
+    uint32_t allocSlot() {
+        if (!freeSlots.empty()) {
+            uint32_t i = freeSlots.back();
+            freeSlots.pop_back();
+            return i;
+        }
+        if (slotCount % CHUNK == 0) chunks.emplace_back(new Slot[CHUNK]);
+        return slotCount++;
+    }
+    
+    void unlink(uint32_t i) {
+        Slot& rec = slot(i);
+        if (rec.newer != NONE) slot(rec.newer).older = rec.older; else mru = rec.older;
+        if (rec.older != NONE) slot(rec.older).newer = rec.newer; else lru = rec.newer;
+        rec.newer = rec.older = NONE;
+    }
+    
+    void linkMostRecent(uint32_t i) {
+        Slot& rec = slot(i);
+        rec.newer = NONE;
+        rec.older = mru;
+        if (mru != NONE) slot(mru).newer = i; else lru = i;
+        mru = i;
+    }
+    
+  public:
+    long evictions = 0;           // Records dropped to stay under maxPeers
+    long expirations = 0;         // Records dropped after peerIdleTimeout
+    size_t peakPeers = 0;
+    size_t peakBytes = 0;
+    
+    PeerTable() { buckets.assign(16, Bucket{0, EMPTY}); }
+    
+    // Reads maxPeers, peerIdleTimeout and timeWaitTimeout from the module
+    void configure(cModule* module) {
+        maxPeers = module->par("maxPeers").intValue();
+        idleTimeout = module->par("peerIdleTimeout").doubleValue();
+        timeWaitTimeout = module->par("timeWaitTimeout").doubleValue();
+        peerCountVector.setName("peerCount");
+        memoryVector.setName("peerTableBytes");
+    }
+    
+    PeerState* find(long addr) {
+        const Bucket& b = buckets[probe(addr)];
+        return b.slot < DELETED && b.addr == addr ? &slot(b.slot).state : nullptr;
+    }
+    
+    // Marks an existing record active without creating one
+    PeerState* touch(long addr) {
+        const Bucket& b = buckets[probe(addr)];
+        if (b.slot >= DELETED || b.addr != addr) return nullptr;
+        if (mru != b.slot) {
+            unlink(b.slot);
+            linkMostRecent(b.slot);
+        }
+        slot(b.slot).state.lastActive = simTime();
+        return &slot(b.slot).state;
+    }
+    
+    // Finds or creates the record for addr and marks it active
+    PeerState& get(long addr) {
+        if (PeerState* peer = touch(addr)) return *peer;
+        size_t i = probe(addr);
+        if (maxPeers > 0 && live >= maxPeers) {
+            evictions++;
+            erase(slot(lru).state.addr);
+            i = probe(addr);
+        }
+        if ((live + deleted + 1) * 4 > buckets.size() * 3) {
+            rehash(live * 4 >= buckets.size() ? buckets.size() * 2 : buckets.size());
+            i = probe(addr);
+        }
+        if (buckets[i].slot == DELETED) deleted--;
+        uint32_t s = allocSlot();
+        Slot& rec = slot(s);
+        rec.state = PeerState();
+        rec.state.addr = addr;
+        rec.state.lastActive = simTime();
+        rec.live = true;
+        linkMostRecent(s);
+        buckets[i] = Bucket{addr, s};
+        live++;
+        peakPeers = max(peakPeers, live);
+        return rec.state;
+    }
+    
+    void erase(long addr) {
+        size_t i = probe(addr);
+        if (buckets[i].slot >= DELETED || buckets[i].addr != addr) return;
+        uint32_t s = buckets[i].slot;
+        Slot& rec = slot(s);
+        unlink(s);
+        rec.live = false;
+        rec.generation++;
+        rec.state = PeerState();  // Drop strings and key schedules now
+        freeSlots.push_back(s);
+        buckets[i].slot = DELETED;
+        live--;
+        deleted++;
+    }
+    
+    PeerHandle handle(long addr) {
+        PeerHandle h;
+        const Bucket& b = buckets[probe(addr)];
+        if (b.slot < DELETED && b.addr == addr) {
+            h.index = b.slot;
+            h.generation = slot(b.slot).generation;
+        }
+        return h;
+    }
+    
+    PeerState* resolve(const PeerHandle& h) const {
+        if (h.index >= slotCount) return nullptr;
+        Slot& rec = slot(h.index);
+        return rec.live && rec.generation == h.generation ? &rec.state : nullptr;
+    }
+    
+    // Moves the peer's connection to TIME_WAIT; age() clears it later
+    void closeConnection(PeerState& peer) {
+        peer.tcp.state = TCP_TIME_WAIT;
+        timeWait.push_back(make_pair(simTime() + timeWaitTimeout, handle(peer.addr)));
+    }
+    
+    // Applies TIME_WAIT and idle timeouts and samples memory use
+    void age() {
+        simtime_t now = simTime();
+        while (!timeWait.empty() && timeWait.front().first <= now) {
+            PeerState* peer = resolve(timeWait.front().second);
+            if (peer && peer->tcp.state == TCP_TIME_WAIT) {
+                peer->tcp = TCPConnection();
+            }
+            timeWait.pop_front();
+        }
+        while (idleTimeout > 0 && lru != NONE && now - slot(lru).state.lastActive > idleTimeout) {
+            expirations++;
+            erase(slot(lru).state.addr);
+        }
+        size_t bytes = memoryBytes();
+        peakBytes = max(peakBytes, bytes);
+        peerCountVector.record((double)live);
+        memoryVector.record((double)bytes);
+    }
+    
+    template <typename Fn>
+    void forEach(Fn fn) {
+        for (uint32_t i = 0; i < slotCount; i++) {
+            if (slot(i).live) fn(slot(i).state);
+        }
+    }
+    
+    size_t size() const { return live; }
+    
+    // Slab, index and per-record heap usage in bytes
+    size_t memoryBytes() {
+        size_t bytes = chunks.size() * CHUNK * sizeof(Slot) + buckets.capacity() * sizeof(Bucket) +
+                       freeSlots.capacity() * sizeof(uint32_t) +
+                       timeWait.size() * sizeof(pair<simtime_t, PeerHandle>);
+        forEach([&](PeerState& peer) { bytes += peer.dynamicBytes(); });
+        return bytes;
+    }
+    
+    void recordScalars(cComponent* module) {
+        module->recordScalar("peers", live);
+        module->recordScalar("peakPeers", peakPeers);
+        module->recordScalar("peerEvictions", evictions);
+        module->recordScalar("peerExpirations", expirations);
+        module->recordScalar("peerTableBytes", memoryBytes());
+        module->recordScalar("peakPeerTableBytes", max(peakBytes, memoryBytes()));
+    }
+};
+
 // Helper functions
 static cPacket* mk(const char* name, int kind, long src, long dst) {
     auto *m = new cPacket(name, kind);
@@ -204,6 +889,7 @@ static cPacket* mk(const char* name, int kind, long src, long dst) {
     m->addPar("seq").setLongValue(0);
     m->addPar("ack").setLongValue(0);
     m->addPar("priority").setLongValue(PRIORITY_NORMAL);
+    m->addPar("ttl").setLongValue(DEFAULT_TTL);
     m->setByteLength(1000);  // Default packet size
     return m;
 }
@@ -213,6 +899,1248 @@ static inline long DST(cMessage* m){ return m->par("dst").longValue(); }
 static inline long SEQ(cMessage* m){ return m->par("seq").longValue(); }
 static inline long ACK(cMessage* m){ return m->par("ack").longValue(); }
 static inline int PRIORITY(cMessage* m){ return m->par("priority").longValue(); }
+static inline int TTL(cMessage* m){ return m->par("ttl").longValue(); }
+
+// ECN codepoints of par("ecn"), as in the IP header's ECN field
+static const int ECN_ECT = 2;   // ECN-capable transport
+static const int ECN_CE = 3;    // Congestion experienced, set by a router
+static inline bool ceMarked(cMessage* m) {
+    return m->hasPar("ecn") && m->par("ecn").longValue() == ECN_CE;
+}
+
+// Application payload size: the "bytes" par when present, else the wire size
+static inline long payloadBytes(cMessage* m) {
+    if (m->hasPar("bytes")) return m->par("bytes").longValue();
+    cPacket* pkt = dynamic_cast<cPacket*>(m);
+    return pkt ? pkt->getByteLength() : 0;
+}
+
+// Both messages lack the optional long par, or both carry the same value
+static inline bool sameLongPar(cMessage* a, cMessage* b, const char* name) {
+    if (a->hasPar(name) != b->hasPar(name)) return false;
+    return !a->hasPar(name) || a->par(name).longValue() == b->par(name).longValue();
+}
+
+// Immutable, reference-counted payload body. Stored in a pointer par so
+// that dup() of the packet (flooding, multicast) bumps the count instead
+// of copying the bytes; the body is freed with the last packet holding it.
+struct PayloadChunk {
+    const string data;
+    int refs;
+    
+    explicit PayloadChunk(const string& d) : data(d), refs(1) {}
+};
+
+static void* payloadChunkDup(void* p) {
+    static_cast<PayloadChunk*>(p)->refs++;
+    return p;
+}
+
+static void payloadChunkRelease(void* p) {
+    PayloadChunk* chunk = static_cast<PayloadChunk*>(p);
+    if (--chunk->refs == 0) delete chunk;
+}
+
+// Sets a par to a new shared payload holding a copy of data
+static cMsgPar& setPayload(cMsgPar& par, const string& data) {
+    par.setLongValue(0);  // Release whatever the par held before
+    par.setPointerValue(new PayloadChunk(data));
+    par.configPointer(payloadChunkRelease, payloadChunkDup);
+    return par;
+}
+
+static const string& getPayload(cMessage* m, const char* name) {
+    static const string empty;
+    if (!m->hasPar(name)) return empty;
+    PayloadChunk* chunk = static_cast<PayloadChunk*>(m->par(name).pointerValue());
+    return chunk ? chunk->data : empty;
+}
+
+// Freelist of packets and their pars, owned by one module. Packets
+// that arrive at a module are recycled into its pool instead of being
+// deleted, and mk()/dup() draw from the pool before allocating. Request
+// and response traffic is symmetric, so every module's pool refills at
+// the rate it drains. Build with -DHYBRID_NO_PACKET_POOL to compare
+// against plain new/delete.
+class PacketPool {
+  private:
+    static const int STANDARD_PARS = 6;       // src, dst, seq, ack, priority, ttl (see mk())
+    static const size_t MAX_FREE = 4096;
+    vector<cPacket*> freePackets;
+    vector<cMsgPar*> freePars;
+    
+  public:
+    long packetAllocs = 0;   // packets obtained from new
+    long packetReuses = 0;   // packets obtained from the freelist
+    long parAllocs = 0;
+    long parReuses = 0;
+    
+    ~PacketPool() { clear(); }
+    
+    cPacket* get(const char* name, int kind, long src, long dst) {
+#ifndef HYBRID_NO_PACKET_POOL
+        if (!freePackets.empty()) {
+            cPacket* m = freePackets.back();
+            freePackets.pop_back();
+            packetReuses++;
+            m->setName(name);
+            m->setKind(kind);
+            m->setByteLength(1000);
+            m->setBitError(false);
+            m->setTimestamp(0);
+            m->setSchedulingPriority(0);
+            m->par(0).setLongValue(src);
+            m->par(1).setLongValue(dst);
+            m->par(2).setLongValue(0);
+            m->par(3).setLongValue(0);
+            m->par(4).setLongValue(PRIORITY_NORMAL);
+            m->par(5).setLongValue(DEFAULT_TTL);
+            return m;
+        }
+#endif
+        packetAllocs++;
+        return mk(name, kind, src, dst);
+    }
+    
+    // Pooled replacement for msg->addPar(name)
+    cMsgPar& addPar(cMessage* m, const char* name) {
+#ifndef HYBRID_NO_PACKET_POOL
+        if (!freePars.empty()) {
+            cMsgPar* p = freePars.back();
+            freePars.pop_back();
+            parReuses++;
+            p->setName(name);
+            return m->addPar(p);
+        }
+#endif
+        parAllocs++;
+        return m->addPar(name);
+    }
+    
+    // Pooled removal of a par. Remove only the most recently added pars, so
+    // that the par list has no holes for dup() and release()
+    void removePar(cMessage* m, const char* name) {
+        cArray& pars = m->getParList();
+        int i = pars.find(name);
+        if (i < STANDARD_PARS) return;
+        cMsgPar* p = check_and_cast<cMsgPar*>(pars.remove(i));
+        p->setLongValue(0);
+#ifndef HYBRID_NO_PACKET_POOL
+        if (freePars.size() < MAX_FREE) {
+            freePars.push_back(p);
+            return;
+        }
+#endif
+        delete p;
+    }
+    
+    // Pooled replacement for msg->dup(): copies the header and all pars
+    cPacket* dup(cMessage* msg) {
+        cPacket* src = check_and_cast<cPacket*>(msg);
+        if (!hasStandardPars(src)) {
+            packetAllocs++;
+            return src->dup();
+        }
+        cPacket* copy = get(src->getName(), src->getKind(), SRC(src), DST(src));
+        copy->setByteLength(src->getByteLength());
+        copy->setTimestamp(src->getTimestamp());
+        for (int i = 2; i < STANDARD_PARS; i++) {
+            copy->par(i) = src->par(i);
+        }
+        cArray& pars = src->getParList();
+        for (int i = STANDARD_PARS; i < pars.size(); i++) {
+            cMsgPar* p = check_and_cast<cMsgPar*>(pars.get(i));
+            addPar(copy, p->getName()) = *p;
+        }
+        return copy;
+    }
+    
+    // Pooled replacement for `delete msg`
+    void release(cMessage* msg) {
+#ifdef HYBRID_NO_PACKET_POOL
+        delete msg;
+#else
+        cPacket* pkt = msg->isPacket() ? static_cast<cPacket*>(msg) : nullptr;
+        if (!pkt || !hasStandardPars(pkt) || pkt->getEncapsulatedPacket() ||
+            freePackets.size() >= MAX_FREE) {
+            delete msg;
+            return;
+        }
+        // Strip everything beyond the standard header pars
+        cArray& pars = pkt->getParList();
+        for (int i = pars.size() - 1; i >= STANDARD_PARS; i--) {
+            cMsgPar* p = check_and_cast<cMsgPar*>(pars.remove(i));
+            p->setLongValue(0);  // Frees string/pointer values now
+            if (freePars.size() < MAX_FREE) {
+                freePars.push_back(p);
+            } else {
+                delete p;
+            }
+        }
+        delete pkt->removeControlInfo();
+        freePackets.push_back(pkt);
+#endif
+    }
+    
+    void clear() {
+        for (auto* m : freePackets) delete m;
+        for (auto* p : freePars) delete p;
+        freePackets.clear();
+        freePars.clear();
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("poolPacketAllocs", packetAllocs);
+        module->recordScalar("poolPacketReuses", packetReuses);
+        module->recordScalar("poolParAllocs", parAllocs);
+        module->recordScalar("poolParReuses", parReuses);
+    }
+    
+  private:
+    static bool hasStandardPars(cPacket* m) {
+        static const char* names[STANDARD_PARS] = {"src", "dst", "seq", "ack", "priority", "ttl"};
+        cArray& pars = m->getParList();
+        if (pars.size() < STANDARD_PARS) return false;
+        for (int i = 0; i < STANDARD_PARS; i++) {
+            cObject* p = pars.get(i);
+            if (!p || strcmp(p->getName(), names[i]) != 0) return false;
+        }
+        return true;
+    }
+};
+
+// Transport + network header carried by each wire segment of an offloaded send
+static const int HEADER_BYTES = 40;
+// Network header repeated in every fragment
+static const int IP_HEADER_BYTES = 20;
+
+// MTU of the channel behind an output gate, from its "mtu" parameter
+static int channelMtu(cGate* out) {
+    cChannel* channel = out->findTransmissionChannel();
+    return channel && channel->hasPar("mtu") ? (int)channel->par("mtu").intValue() : INT_MAX;
+}
+
+// True for ordinary packets and for the final segment of an offloaded send
+static inline bool isLastSegment(cMessage* m) {
+    if (!m->hasPar("segOffset")) return true;
+    long segBytes = static_cast<cPacket*>(m)->getByteLength() - HEADER_BYTES;
+    return m->par("segOffset").longValue() + segBytes >= m->par("bytes").longValue();
+}
+
+// Path MTU discovery (RFC 1191) for a sender. Packets leave marked Don't
+// Fragment; a router whose next link is too small drops such a packet and
+// answers PACKET_TOO_BIG with that link's MTU, which is remembered for the
+// destination for timeout. The packet comes back quoted in the error and is
+// resent once without DF, so the router fragments it instead.
+class PathMtuCache {
+  private:
+    struct Entry {
+        int mtu;
+        simtime_t learned;
+    };
+    map<long, Entry> paths;      // dst -> discovered MTU
+    
+  public:
+    bool enabled = true;
+    int linkMtu = INT_MAX;       // MTU of the module's own link
+    simtime_t timeout = 600;     // Then try the link MTU again
+    long updates = 0;            // Path MTUs lowered by PACKET_TOO_BIG
+    long resends = 0;            // Packets resent after PACKET_TOO_BIG
+    
+    void configure(cSimpleModule* module) {
+        enabled = module->par("pmtud").boolValue();
+        timeout = module->par("pmtuTimeout").doubleValue();
+        linkMtu = channelMtu(module->gate("ppp$o"));
+    }
+    
+    int get(long dst) const {
+        auto it = paths.find(dst);
+        if (it == paths.end() || simTime() - it->second.learned >= timeout) return linkMtu;
+        return min(linkMtu, it->second.mtu);
+    }
+    
+    void mark(cMessage* msg, PacketPool& pool) {
+        if (enabled) pool.addPar(msg, "df").setBoolValue(true);
+    }
+    
+    // Learns from a PACKET_TOO_BIG and returns the quoted packet to resend,
+    // or nullptr. Segments already cut for the old MTU and still in the
+    // egress queue lose DF too, rather than each costing an error. The
+    // caller still releases err.
+    cPacket* packetTooBig(cMessage* err, cQueue& queue) {
+        long dst = err->par("origDst").longValue();
+        int mtu = err->par("mtu").longValue();
+        if (mtu < get(dst)) {
+            paths[dst] = Entry{mtu, simTime()};
+            updates++;
+        }
+        for (int i = 0; i < queue.getLength(); i++) {
+            cMessage* queued = static_cast<cMessage*>(queue.get(i));
+            if (DST(queued) == dst && queued->hasPar("df")) queued->par("df").setBoolValue(false);
+        }
+        cPacket* quoted = static_cast<cPacket*>(err)->decapsulate();
+        if (!quoted) return nullptr;
+        quoted->setByteLength(err->par("origBytes").longValue());
+        quoted->par("df").setBoolValue(false);
+        quoted->par("ttl").setLongValue(DEFAULT_TTL);
+        resends++;
+        return quoted;
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("pmtuUpdates", updates);
+        module->recordScalar("pmtuResends", resends);
+    }
+};
+
+// Generic segmentation offload (GSO) for endpoint egress queues. A module
+// builds one packet for a whole logical send ("bytes" = e.g. a full page)
+// and marks it with offload(); the egress cuts one wire segment of at most
+// segSize payload bytes off it each time the channel frees up, so the rest
+// waits as a single packet at the head of the queue. Segment k carries
+// seq + k, and the original packet goes out as the last segment. The
+// segment size is mss, capped by the path MTU when paths is set.
+class SegmentationOffload {
+  public:
+    bool enabled = true;
+    long mss = 1460;          // Payload bytes per wire segment
+    const PathMtuCache* paths = nullptr;
+    long sends = 0;           // Offloaded sends that needed more than one segment
+    long segments = 0;        // Wire segments cut from them
+    
+    void configure(cModule* module) {
+        enabled = module->par("gso").boolValue();
+        mss = max(1L, (long)module->par("mss").intValue());
+    }
+    
+    long segmentSize(long dst) const {
+        if (!paths) return mss;
+        return max(1L, min(mss, (long)paths->get(dst) - HEADER_BYTES));
+    }
+    
+    // Wire segments an offloaded packet will take
+    long segmentCount(cMessage* msg) const {
+        if (!msg->hasPar("segOffset")) return 1;
+        long size = msg->par("segSize").longValue();
+        return (msg->par("bytes").longValue() + size - 1) / size;
+    }
+    
+    // Hands the packet's "bytes" to the egress for segmentation; the packet
+    // is as long as everything it still carries
+    void offload(cMessage* msg, PacketPool& pool) {
+        long bytes = msg->par("bytes").longValue();
+        long size = segmentSize(DST(msg));
+        if (enabled && bytes > size) {
+            pool.addPar(msg, "segOffset").setLongValue(0);
+            pool.addPar(msg, "segSize").setLongValue(size);
+            static_cast<cPacket*>(msg)->setByteLength(bytes + HEADER_BYTES);
+            sends++;
+        }
+    }
+    
+    // Next packet to put on the wire for msg, the head of the egress queue.
+    // Unless msg fits in one segment, it goes back to the queue head holding
+    // the remainder.
+    cMessage* next(cMessage* msg, cQueue& queue, PacketPool& pool) {
+        if (!msg->hasPar("segOffset")) return msg;
+        cPacket* pkt = static_cast<cPacket*>(msg);
+        long size = pkt->par("segSize").longValue();
+        long carried = pkt->getByteLength() - HEADER_BYTES;
+        if (carried <= size) return msg;  // Last segment, or a resend
+        cPacket* seg = pool.dup(pkt);
+        seg->setByteLength(size + HEADER_BYTES);
+        segments++;
+        pkt->par("segOffset").setLongValue(pkt->par("segOffset").longValue() + size);
+        pkt->par("seq").setLongValue(SEQ(pkt) + 1);
+        pkt->setByteLength(carried - size + HEADER_BYTES);
+        if (queue.isEmpty()) {
+            queue.insert(pkt);
+        } else {
+            queue.insertBefore(queue.front(), pkt);
+        }
+        return seg;
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("gsoSends", sends);
+        module->recordScalar("gsoSegments", segments + sends);
+    }
+};
+
+// Reassembly of router fragments at the destination. Each datagram keeps
+// the first fragment to arrive, which becomes the whole packet, and the
+// payload ranges received so far as a sorted list of disjoint intervals,
+// so overlapping and duplicate fragments cost nothing extra. Datagrams
+// still incomplete after timeout are dropped, and the oldest is dropped
+// while more than maxBytes are buffered. Datagrams are also indexed by
+// deadline, so both cost O(log n); the owner arms its reassembly timer for
+// nextDeadline() and calls expire() when it fires.
+class ReassemblyBuffer {
+  private:
+    typedef pair<long, long> Key;      // (src, fragId)
+    struct Datagram {
+        cMessage* head;
+        long total;                    // Payload bytes of the whole datagram
+        vector<pair<long, long>> have; // [begin, end) ranges received
+        long held;                     // Bytes covered by have
+        multimap<simtime_t, Key>::iterator deadline;
+    };
+    map<Key, Datagram> datagrams;
+    multimap<simtime_t, Key> deadlines;  // firstArrival + timeout -> datagram, oldest first
+    long heldBytes = 0;
+    long peakBytes = 0;
+    
+  public:
+    long maxBytes = 1 << 20;
+    simtime_t timeout = 30;
+    long fragments = 0;
+    long reassembled = 0;
+    long timeouts = 0;
+    long evictions = 0;
+    
+    ~ReassemblyBuffer() { clear(); }
+    
+    void configure(cModule* module) {
+        maxBytes = module->par("reassemblyBytes").intValue();
+        timeout = module->par("reassemblyTimeout").doubleValue();
+    }
+    
+    // Takes one fragment; returns the whole packet once the last missing
+    // fragment has arrived, else nullptr
+    cMessage* add(cMessage* frag, PacketPool& pool) {
+        fragments++;
+        expire(pool);
+        long begin = frag->par("fragOffset").longValue();
+        long end = begin + static_cast<cPacket*>(frag)->getByteLength() - IP_HEADER_BYTES;
+        Key key = make_pair(SRC(frag), frag->par("fragId").longValue());
+        auto it = datagrams.find(key);
+        if (it == datagrams.end()) {
+            long total = frag->par("fragBytes").longValue() - IP_HEADER_BYTES;
+            auto deadline = deadlines.emplace(simTime() + timeout, key);
+            it = datagrams.emplace(key, Datagram{frag, total, {}, 0, deadline}).first;
+        } else {
+            pool.release(frag);
+        }
+        Datagram& d = it->second;
+        long added = insert(d.have, begin, end);
+        d.held += added;
+        heldBytes += added;
+        peakBytes = max(peakBytes, heldBytes);
+        
+        if (d.have.size() == 1 && d.have[0].first == 0 && d.have[0].second >= d.total) {
+            cPacket* whole = static_cast<cPacket*>(d.head);
+            heldBytes -= d.held;
+            deadlines.erase(d.deadline);
+            datagrams.erase(it);
+            whole->setByteLength(whole->par("fragBytes").longValue());
+            pool.removePar(whole, "fragBytes");
+            pool.removePar(whole, "fragOffset");
+            pool.removePar(whole, "fragId");
+            reassembled++;
+            return whole;
+        }
+        while (heldBytes > maxBytes && !deadlines.empty()) {
+            drop(datagrams.find(deadlines.begin()->second), pool);
+            evictions++;
+        }
+        return nullptr;
+    }
+    
+    bool hasPending() const { return !deadlines.empty(); }
+    
+    // When the oldest incomplete datagram times out; arm the timer for it
+    simtime_t nextDeadline() const {
+        return deadlines.empty() ? SIMTIME_MAX : deadlines.begin()->first;
+    }
+    
+    // Drops the datagrams whose deadline has passed
+    void expire(PacketPool& pool) {
+        while (!deadlines.empty() && deadlines.begin()->first <= simTime()) {
+            timeouts++;
+            drop(datagrams.find(deadlines.begin()->second), pool);
+        }
+    }
+    
+    void clear() {
+        for (auto& entry : datagrams) delete entry.second.head;
+        datagrams.clear();
+        deadlines.clear();
+        heldBytes = 0;
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("fragmentsReceived", fragments);
+        module->recordScalar("packetsReassembled", reassembled);
+        module->recordScalar("reassemblyTimeouts", timeouts);
+        module->recordScalar("reassemblyEvictions", evictions);
+        module->recordScalar("peakReassemblyBytes", peakBytes);
+    }
+    
+  private:
+    // Merges [begin, end) into the interval list; returns the bytes it added
+    static long insert(vector<pair<long, long>>& have, long begin, long end) {
+        long added = end - begin;
+        long b = begin, e = end;
+        vector<pair<long, long>> merged;
+        merged.reserve(have.size() + 1);
+        for (auto& r : have) {
+            if (r.second < begin || r.first > end) {
+                merged.push_back(r);
+                continue;
+            }
+            added -= max(0L, min(r.second, end) - max(r.first, begin));
+            b = min(b, r.first);
+            e = max(e, r.second);
+        }
+        auto pos = lower_bound(merged.begin(), merged.end(), make_pair(b, e));
+        merged.insert(pos, make_pair(b, e));
+        have.swap(merged);
+        return added;
+    }
+    
+    void drop(map<Key, Datagram>::iterator it, PacketPool& pool) {
+        heldBytes -= it->second.held;
+        pool.release(it->second.head);
+        deadlines.erase(it->second.deadline);
+        datagrams.erase(it);
+    }
+};
+
+// Delayed ACKs for the TCP receivers (RFC 1122, RFC 5681 section 4.2).
+// An ACK goes out for every ackEvery-th data segment from a peer, or when
+// the module's delayed-ACK timer fires. A newer ACK for the same flow
+// replaces an older one that is still held back or still waiting in the
+// egress queue, and a held ACK rides on the next data packet to the peer.
+// A flow is a (peer, packet name, "segment" and "request" pars) tuple.
+class DelayedAckControl {
+  private:
+    struct Pending {
+        cMessage* ack;
+        int segments;            // Data segments covered so far
+    };
+    map<long, Pending> pending;  // peer -> ACK held back
+    
+  public:
+    int ackEvery = 2;
+    simtime_t timeout = 0.04;    // 0 sends every ACK at once
+    long acksSent = 0;
+    long acksCoalesced = 0;      // Absorbed by a held or queued ACK
+    long acksPiggybacked = 0;    // Carried by outgoing data instead
+    
+    ~DelayedAckControl() { clear(); }
+    
+    void configure(cModule* module) {
+        ackEvery = max(1, (int)module->par("ackEvery").intValue());
+        timeout = module->par("delayedAckTimeout").doubleValue();
+    }
+    
+    bool enabled() const { return ackEvery > 1 && timeout > 0; }
+    bool hasPending() const { return !pending.empty(); }
+    
+    // Takes the ACK for received data (segments of it, when coalesced);
+    // send(ack) is called for whatever is due now. Arm the delayed-ACK timer
+    // when hasPending().
+    template <typename Send>
+    void submit(cMessage* ack, PacketPool& pool, Send send, int segments = 1) {
+        if (!enabled()) {
+            acksSent++;
+            send(ack);
+            return;
+        }
+        long dst = DST(ack);
+        auto it = pending.find(dst);
+        if (it != pending.end() && !sameFlow(it->second.ack, ack)) {
+            acksSent++;
+            send(it->second.ack);  // The old flow is done; don't hold its ACK
+            pending.erase(it);
+            it = pending.end();
+        }
+        if (it == pending.end()) {
+            it = pending.emplace(dst, Pending{ack, 0}).first;
+        } else {
+            it->second.ack->par("ack").setLongValue(ACK(ack));
+            mergeEcnEcho(it->second.ack, ack);
+            pool.release(ack);
+            acksCoalesced++;
+        }
+        it->second.segments += segments;
+        if (it->second.segments >= ackEvery) {
+            acksSent++;
+            send(it->second.ack);
+            pending.erase(it);
+        }
+    }
+    
+    // Sends ack without delay, as for out-of-order data (RFC 5681 section
+    // 4.2). A held ACK of the same flow is superseded by it; one of another
+    // flow goes out first.
+    template <typename Send>
+    void sendNow(cMessage* ack, PacketPool& pool, Send send) {
+        auto it = pending.find(DST(ack));
+        if (it != pending.end()) {
+            if (sameFlow(it->second.ack, ack)) {
+                mergeEcnEcho(ack, it->second.ack);
+                pool.release(it->second.ack);
+                acksCoalesced++;
+            } else {
+                acksSent++;
+                send(it->second.ack);
+            }
+            pending.erase(it);
+        }
+        acksSent++;
+        send(ack);
+    }
+    
+    // Delayed-ACK timer expiry: everything held back goes out
+    template <typename Send>
+    void flush(Send send) {
+        for (auto& entry : pending) {
+            acksSent++;
+            send(entry.second.ack);
+        }
+        pending.clear();
+    }
+    
+    // Moves a held ACK for the data's destination into its "ack" par
+    void piggyback(cMessage* data, PacketPool& pool) {
+        auto it = pending.find(DST(data));
+        if (it == pending.end() || it->second.ack->hasPar("segment") || it->second.ack->hasPar("ecnEcho")) return;
+        data->par("ack").setLongValue(ACK(it->second.ack));
+        pool.release(it->second.ack);
+        pending.erase(it);
+        acksPiggybacked++;
+    }
+    
+    // Egress coalescing: folds ack into a pure ACK of the same flow still
+    // waiting in the queue. Returns true when ack was absorbed and can be
+    // released. Handshake ACKs carry a seq and are left alone.
+    bool coalesceQueued(cQueue& queue, cMessage* ack) {
+        for (int i = queue.getLength() - 1; i >= 0; i--) {
+            cMessage* queued = static_cast<cMessage*>(queue.get(i));
+            if (queued->getKind() == TCP_ACK && SEQ(queued) == 0 && sameFlow(queued, ack) &&
+                queued->hasPar("ecnEcho") == ack->hasPar("ecnEcho")) {
+                queued->par("ack").setLongValue(max(ACK(queued), ACK(ack)));
+                mergeEcnEcho(queued, ack);
+                acksCoalesced++;
+                acksSent--;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void clear() {
+        for (auto& entry : pending) delete entry.second.ack;
+        pending.clear();
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("acksSent", acksSent);
+        module->recordScalar("acksCoalesced", acksCoalesced);
+        module->recordScalar("acksPiggybacked", acksPiggybacked);
+    }
+    
+  private:
+    static void mergeEcnEcho(cMessage* into, cMessage* from) {
+        if (into->hasPar("ecnEcho") && from->hasPar("ecnEcho")) {
+            into->par("ecnEcho").setLongValue(max(into->par("ecnEcho").longValue(),
+                                                  from->par("ecnEcho").longValue()));
+        }
+    }
+    
+    static bool sameFlow(cMessage* a, cMessage* b) {
+        if (DST(a) != DST(b) || strcmp(a->getName(), b->getName()) != 0) return false;
+        return sameLongPar(a, b, "segment") && sameLongPar(a, b, "request");
+    }
+};
+
+// Receive-side coalescing (GRO) for endpoints. Consecutive in-order data
+// segments of one flow from a peer are held as a run and handed to the
+// application as one delivery of their newest segment, with the number of
+// segments merged. A run is delivered when it ends an offloaded send (or is
+// an ordinary packet), reaches maxBytes, is broken by an out-of-order or
+// other-flow segment, or sees no new segment for window. CE-marked and
+// unmarked segments are never merged, so a run is marked as a whole. A
+// flow is a (peer, kind, packet name, "segment" and "request" pars) tuple.
+class ReceiveCoalescing {
+  private:
+    struct Run {
+        cMessage* msg;           // Newest segment, stands for the run
+        long nextSeq;            // seq that extends the run
+        int segments;
+        long bytes;
+        simtime_t lastArrival;
+    };
+    map<long, Run> runs;         // peer -> run being built
+    
+  public:
+    bool enabled = true;
+    simtime_t window = 0.0002;
+    long maxBytes = 65536;       // Like the 64 KB cap on a GRO packet
+    long segments = 0;           // Data segments received
+    long deliveries = 0;         // Application handler invocations
+    long bytes = 0;
+    
+    ~ReceiveCoalescing() { clear(); }
+    
+    void configure(cModule* module) {
+        enabled = module->par("gro").boolValue();
+        window = module->par("groWindow").doubleValue();
+    }
+    
+    bool hasPending() const { return !runs.empty(); }
+    
+    // When the oldest idle run times out; arm the GRO timer for it
+    simtime_t nextDeadline() const {
+        simtime_t t = SIMTIME_MAX;
+        for (auto& entry : runs) t = min(t, entry.second.lastArrival + window);
+        return t;
+    }
+    
+    // Takes one received data segment; deliver(msg, segments) is called for
+    // every run that is complete now. Arm the timer when hasPending().
+    template <typename Deliver>
+    void receive(cMessage* msg, PacketPool& pool, Deliver deliver) {
+        long len = static_cast<cPacket*>(msg)->getByteLength();
+        segments++;
+        bytes += len;
+        if (!enabled) {
+            deliveries++;
+            deliver(msg, 1);
+            return;
+        }
+        long src = SRC(msg);
+        auto it = runs.find(src);
+        if (it != runs.end() && sameFlow(it->second.msg, msg) && SEQ(msg) == it->second.nextSeq &&
+            ceMarked(msg) == ceMarked(it->second.msg)) {
+            pool.release(it->second.msg);
+            it->second.msg = msg;
+            it->second.segments++;
+            it->second.bytes += len;
+        } else {
+            if (it != runs.end()) {
+                Run run = it->second;
+                runs.erase(it);
+                deliveries++;
+                deliver(run.msg, run.segments);
+            }
+            it = runs.emplace(src, Run{msg, 0, 1, len, 0}).first;
+        }
+        it->second.nextSeq = SEQ(msg) + 1;
+        it->second.lastArrival = simTime();
+        if (isLastSegment(msg) || it->second.bytes >= maxBytes) {
+            Run run = it->second;
+            runs.erase(it);
+            deliveries++;
+            deliver(run.msg, run.segments);
+        }
+    }
+    
+    // GRO timer expiry: runs idle for window are delivered
+    template <typename Deliver>
+    void flushExpired(Deliver deliver) {
+        for (auto it = runs.begin(); it != runs.end();) {
+            if (it->second.lastArrival + window > simTime()) {
+                ++it;
+                continue;
+            }
+            Run run = it->second;
+            it = runs.erase(it);
+            deliveries++;
+            deliver(run.msg, run.segments);
+        }
+    }
+    
+    void clear() {
+        for (auto& entry : runs) delete entry.second.msg;
+        runs.clear();
+    }
+    
+    void recordScalars(cComponent* module) const {
+        module->recordScalar("groSegments", segments);
+        module->recordScalar("groDeliveries", deliveries);
+        module->recordScalar("dataBytesReceived", bytes);
+        module->recordScalar("handlerCallsPerMB", bytes > 0 ? deliveries / (bytes / 1e6) : 0.0);
+    }
+    
+  private:
+    static bool sameFlow(cMessage* a, cMessage* b) {
+        if (a->getKind() != b->getKind() || strcmp(a->getName(), b->getName()) != 0) return false;
+        return sameLongPar(a, b, "segment") && sameLongPar(a, b, "request");
+    }
+};
+
+// DCTCP congestion response for a window-based sender (RFC 8257). alpha
+// estimates the fraction of segments marked CE, updated once per window
+// of data with gain g; the first echoed mark in a window cuts cwnd by
+// alpha / 2, so light congestion costs little throughput while the
+// router queues stay near the marking threshold.
+struct DctcpEstimator {
+    double g = 1.0 / 16;
+    double alpha = 1.0;          // RFC 8257: start by reacting like Reno
+    long echoed = 0;             // Last cumulative CE count from the receiver
+    long acked = 0;              // Segments acknowledged in this window
+    long marked = 0;             // ... of which marked CE
+    long windowEnd = 0;          // seq that closes the observation window
+    bool reduced = false;        // cwnd already cut in this window
+    long reductions = 0;
+    
+    // Starts a new observation window at a new sequence space
+    void restart(long end) {
+        acked = marked = 0;
+        windowEnd = end;
+        reduced = false;
+    }
+    
+    // Takes an ACK up to ack that newly covers newlyAcked segments and
+    // echoes echo CE marks in total; nextSeq is the next segment to send.
+    // Returns the factor to multiply cwnd by.
+    double onAck(long ack, long newlyAcked, long echo, long nextSeq) {
+        long ce = max(0L, echo - echoed);
+        echoed = max(echoed, echo);
+        acked += newlyAcked;
+        marked += ce;
+        double factor = 1.0;
+        if (ce > 0 && !reduced) {
+            factor = 1.0 - alpha / 2;
+            reduced = true;
+            reductions++;
+        }
+        if (ack >= windowEnd) {
+            double fraction = acked > 0 ? min(1.0, (double)marked / acked) : 0.0;
+            alpha = (1 - g) * alpha + g * fraction;
+            restart(nextSeq);
+        }
+        return factor;
+    }
+};
+
+// Router egress queue for one gate: a plain FIFO, or FQ-CoDel (RFC 8290).
+// FQ-CoDel hashes packets by (src, dst, kind) into flows, serves the flows
+// by deficit round robin with a byte quantum, new flows first, and runs
+// CoDel (RFC 8289) on each flow: once a flow's packets have waited longer
+// than target for a whole interval, it drops (ECN-capable packets are
+// marked CE instead) at a rate that grows with the square root of the
+// drop count until the sojourn time falls below target again.
+class EgressQueue {
+  private:
+    struct Entry {
+        cMessage* msg = nullptr;
+        simtime_t enqueued;
+    };
+    struct Flow {
+        deque<Entry> packets;
+        long bytes = 0;
+        long deficit = 0;
+        int list = 0;                // 0 = idle, 1 = new, 2 = old
+        simtime_t firstAboveTime;    // CoDel state
+        simtime_t dropNext;
+        long count = 0;
+        long lastCount = 0;
+        bool dropping = false;
+    };
+    bool fq = false;
+    Flow fifo;                       // FIFO mode: one flow, no CoDel
+    vector<Flow> flows;
+    deque<int> newFlows;
+    deque<int> oldFlows;
+    int length = 0;
+    long byteCount = 0;
+    
+  public:
+    simtime_t target = 0.005;
+    simtime_t interval = 0.1;
+    long quantum = 1514;
+    long codelDrops = 0;
+    long codelMarks = 0;
+    
+    ~EgressQueue() { clear(); }
+    
+    void configure(cModule* module) {
+        fq = strcmp(module->par("queueDiscipline").stringValue(), "FQ_CODEL") == 0;
+        target = module->par("codelTarget").doubleValue();
+        interval = module->par("codelInterval").doubleValue();
+        quantum = max(1L, (long)module->par("fqQuantum").intValue());
+        if (fq) flows.resize(max(1, (int)module->par("fqFlows").intValue()));
+    }
+    
+    bool isEmpty() const { return length == 0; }
+    int getLength() const { return length; }
+    long getBytes() const { return byteCount; }
+    
+    void insert(cMessage* msg) {
+        long len = byteLength(msg);
+        length++;
+        byteCount += len;
+        Flow& f = fq ? flows[flowIndex(msg)] : fifo;
+        f.packets.push_back(Entry{msg, simTime()});
+        f.bytes += len;
+        if (fq && f.list == 0) {
+            f.list = 1;
+            f.deficit = quantum;
+            newFlows.push_back(&f - &flows[0]);
+        }
+    }
+    
+    // Next packet to transmit, or nullptr once everything left was dropped.
+    // CoDel drops are handed to drop(msg); sojourn is set to the returned
+    // packet's time in the queue.
+    template <typename Drop>
+    cMessage* pop(Drop drop, simtime_t& sojourn) {
+        Entry e;
+        if (!fq) {
+            if (fifo.packets.empty()) return nullptr;
+            e = popHead(fifo);
+            sojourn = simTime() - e.enqueued;
+            return e.msg;
+        }
+        while (true) {
+            deque<int>* list = !newFlows.empty() ? &newFlows : !oldFlows.empty() ? &oldFlows : nullptr;
+            if (!list) return nullptr;
+            int i = list->front();
+            Flow& f = flows[i];
+            if (f.deficit <= 0) {
+                f.deficit += quantum;
+                list->pop_front();
+                oldFlows.push_back(i);
+                f.list = 2;
+                continue;
+            }
+            if (!codelDequeue(f, e, drop)) {
+                // An emptied new flow takes one turn on the old list first,
+                // so that a flow cannot stay new by sending in bursts
+                list->pop_front();
+                if (list == &newFlows) {
+                    oldFlows.push_back(i);
+                    f.list = 2;
+                } else {
+                    f.list = 0;
+                }
+                continue;
+            }
+            f.deficit -= byteLength(e.msg);
+            sojourn = simTime() - e.enqueued;
+            return e.msg;
+        }
+    }
+    
+    void clear() {
+        for (auto& e : fifo.packets) delete e.msg;
+        fifo.packets.clear();
+        for (auto& f : flows) {
+            for (auto& e : f.packets) delete e.msg;
+            f.packets.clear();
+        }
+        newFlows.clear();
+        oldFlows.clear();
+        length = 0;
+        byteCount = 0;
+    }
+    
+  private:
+    static long byteLength(cMessage* msg) {
+        return msg->isPacket() ? static_cast<cPacket*>(msg)->getByteLength() : 0;
+    }
+    
+    int flowIndex(cMessage* msg) const {
+        uint64_t h = (uint64_t)SRC(msg) * 0x9E3779B97F4A7C15ULL;
+        h ^= (uint64_t)DST(msg) + 0x7F4A7C15ULL + (h << 6) + (h >> 2);
+        h ^= (uint64_t)msg->getKind() + (h << 6) + (h >> 2);
+        return h % flows.size();
+    }
+    
+    Entry popHead(Flow& f) {
+        Entry e = f.packets.front();
+        f.packets.pop_front();
+        long len = byteLength(e.msg);
+        f.bytes -= len;
+        length--;
+        byteCount -= len;
+        return e;
+    }
+    
+    // Pops f's head into e; true when its sojourn time has stayed above
+    // target for an interval (and the flow holds more than one packet)
+    bool doDequeue(Flow& f, Entry& e, simtime_t now) {
+        if (f.packets.empty()) {
+            e.msg = nullptr;
+            f.firstAboveTime = 0;
+            return false;
+        }
+        e = popHead(f);
+        if (now - e.enqueued < target || f.bytes <= quantum) {
+            f.firstAboveTime = 0;
+            return false;
+        }
+        if (f.firstAboveTime == 0) {
+            f.firstAboveTime = now + interval;
+            return false;
+        }
+        return now >= f.firstAboveTime;
+    }
+    
+    simtime_t controlLaw(simtime_t t, long count) const {
+        return t + interval / sqrt((double)count);
+    }
+    
+    // Marks e CE if it is ECN-capable, else drops it
+    template <typename Drop>
+    bool markOrDrop(Entry& e, Drop drop) {
+        if (e.msg->hasPar("ecn")) {
+            e.msg->par("ecn").setLongValue(ECN_CE);
+            codelMarks++;
+            return true;
+        }
+        codelDrops++;
+        drop(e.msg);
+        e.msg = nullptr;
+        return false;
+    }
+    
+    // CoDel dequeue (RFC 8289) for one flow; false when it has nothing left
+    template <typename Drop>
+    bool codelDequeue(Flow& f, Entry& e, Drop drop) {
+        simtime_t now = simTime();
+        bool okToDrop = doDequeue(f, e, now);
+        if (!e.msg) {
+            f.dropping = false;
+            return false;
+        }
+        if (f.dropping) {
+            if (!okToDrop) {
+                f.dropping = false;
+            }
+            while (f.dropping && now >= f.dropNext) {
+                f.count++;
+                if (markOrDrop(e, drop)) {
+                    f.dropNext = controlLaw(f.dropNext, f.count);
+                    break;
+                }
+                okToDrop = doDequeue(f, e, now);
+                if (!e.msg) {
+                    f.dropping = false;
+                    return false;
+                }
+                if (!okToDrop) {
+                    f.dropping = false;
+                } else {
+                    f.dropNext = controlLaw(f.dropNext, f.count);
+                }
+            }
+        } else if (okToDrop) {
+            if (!markOrDrop(e, drop)) {
+                doDequeue(f, e, now);
+            }
+            f.dropping = true;
+            long delta = f.count - f.lastCount;
+            f.count = 1;
+            if (delta > 1 && now - f.dropNext < 16 * interval) f.count = delta;
+            f.dropNext = controlLaw(now, f.count);
+            f.lastCount = f.count;
+            if (!e.msg) return false;
+        }
+        return true;
+    }
+};
+
+// Packet memory shared by all egress queues of a router, limited to
+// capacity bytes (0 = unlimited). Each port may queue up to alpha times the
+// memory still free (Choudhury-Hahne dynamic thresholds): a lone busy port
+// can take a large share, and the share shrinks as other ports fill up, so
+// some memory is always left for a port that becomes active.
+class SharedBuffer {
+  private:
+    long used = 0;
+    long peak = 0;
+    map<int, long> portDrops;
+    long priorityDrops[PRIORITY_CRITICAL + 1] = {};
+    long droppedBytes = 0;
+    
+  public:
+    long capacity = 0;
+    double alpha = 1.0;
+    
+    void configure(cModule* module) {
+        capacity = module->par("bufferBytes").intValue();
+        alpha = module->par("bufferAlpha").doubleValue();
+    }
+    
+    long getUsed() const { return used; }
+    
+    // Current queue limit for every port
+    long threshold() const {
+        return capacity > 0 ? (long)(alpha * (capacity - used)) : LONG_MAX;
+    }
+    
+    // Takes len bytes for a port already queueing portBytes, or counts a drop
+    bool admit(int port, int priority, long portBytes, long len) {
+        if (capacity <= 0 || (used + len <= capacity && portBytes + len <= threshold())) {
+            used += len;
+            peak = max(peak, used);
+            return true;
+        }
+        portDrops[port]++;
+        priorityDrops[max(0, min(priority, (int)PRIORITY_CRITICAL))]++;
+        droppedBytes += len;
+        return false;
+    }
+    
+    void release(long len) { used = max(0L, used - len); }
+    
+    // bufferDrops, bufferDroppedBytes, peakBufferBytes, plus drops per
+    // port (bufferDrops-gate<i>) and per priority (bufferDrops-priority<p>)
+    void recordScalars(cComponent* module) const {
+        long drops = 0;
+        for (auto& entry : portDrops) {
+            drops += entry.second;
+            module->recordScalar(("bufferDrops-gate" + to_string(entry.first)).c_str(), entry.second);
+        }
+        for (int p = 0; p <= PRIORITY_CRITICAL; p++) {
+            module->recordScalar(("bufferDrops-priority" + to_string(p)).c_str(), priorityDrops[p]);
+        }
+        module->recordScalar("bufferDrops", drops);
+        module->recordScalar("bufferDroppedBytes", droppedBytes);
+        module->recordScalar("peakBufferBytes", peak);
+    }
+};
+
+// Routing protocol traffic, handled by a router's control plane
+static inline bool isRoutingMessage(cMessage* m) {
+    int kind = m->getKind();
+    return (kind >= OSPF_HELLO && kind <= BFD_CONTROL) || kind == BGP_UPDATE || kind == BGP_KEEPALIVE;
+}
+
+// DiffServ class of a packet at an edge router, from its kind alone so a
+// host cannot promote its own traffic: connection setup, DNS and key
+// exchange are CRITICAL, ACKs and small requests HIGH, data NORMAL and
+// video chunks LOW
+static inline int diffservClass(cMessage* m) {
+    switch (m->getKind()) {
+        case DNS_QUERY: case DNS_RESPONSE: case KEY_EXCHANGE: case SESSION_TICKET:
+        case TCP_SYN: case TCP_SYN_ACK: case TCP_FIN:
+            return PRIORITY_CRITICAL;
+        case TCP_ACK: case VIDEO_REQUEST: case DB_QUERY: case MAIL_REQUEST:
+            return PRIORITY_HIGH;
+        case VIDEO_CHUNK:
+            return PRIORITY_LOW;
+        default:
+            return PRIORITY_NORMAL;
+    }
+}
+
+// Token bucket policer: rate bytes/s refill up to burst bytes
+struct TokenBucket {
+    double rate = 0;         // 0 = unpoliced
+    double burst = 0;
+    double tokens = 0;
+    simtime_t last;
+    
+    // True if len bytes are in profile now; takes the tokens
+    bool conform(long len) {
+        if (rate <= 0) return true;
+        tokens = min(burst, tokens + rate * (simTime() - last).dbl());
+        last = simTime();
+        if (tokens < len) return false;
+        tokens -= len;
+        return true;
+    }
+};
+
+// Calendar queue for paced release: slots buckets of width slot, each
+// holding the packets due in that slot, so insertion and release cost O(1)
+// per packet. Departures further than one revolution (slots x slot) ahead
+// are refused rather than wrapped.
+class CalendarQueue {
+  private:
+    struct Entry {
+        cMessage* msg;
+        int gate;
+    };
+    vector<vector<Entry>> buckets;
+    long current = 0;        // Absolute slot number of the next release
+    int count = 0;
+    
+    // Integer arithmetic, so a timer set for a slot's start lands in that slot
+    long slotOf(simtime_t t) const { return t.raw() / slot.raw(); }
+    
+  public:
+    simtime_t slot = 0.0001;
+    
+    ~CalendarQueue() { clear(); }
+    
+    void configure(simtime_t width, int slots) {
+        slot = width;
+        buckets.assign(max(1, slots), vector<Entry>());
+        current = slotOf(simTime());
+    }
+    
+    bool isEmpty() const { return count == 0; }
+    int getLength() const { return count; }
+    simtime_t horizon() const { return slot * (double)buckets.size(); }
+    
+    // False if at is more than one revolution ahead
+    bool insert(cMessage* msg, int gate, simtime_t at) {
+        if (count == 0) current = slotOf(simTime());
+        long n = max(current, slotOf(at));
+        if (n - current >= (long)buckets.size()) return false;
+        buckets[n % buckets.size()].push_back(Entry{msg, gate});
+        count++;
+        return true;
+    }
+    
+    // Hands release(msg, gate) every packet due by now
+    template <typename Release>
+    void releaseDue(Release release) {
+        long now = slotOf(simTime());
+        for (; count > 0 && current <= now; current++) {
+            vector<Entry> due;
+            due.swap(buckets[current % buckets.size()]);
+            count -= due.size();
+            for (auto& e : due) release(e.msg, e.gate);
+        }
+    }
+    
+    // Start of the next occupied slot, SIMTIME_MAX when empty
+    simtime_t nextRelease() const {
+        if (count == 0) return SIMTIME_MAX;
+        for (long n = current; ; n++) {
+            if (!buckets[n % buckets.size()].empty()) return slot * n;
+        }
+    }
+    
+    void clear() {
+        for (auto& b : buckets) {
+            for (auto& e : b) delete e.msg;
+            b.clear();
+        }
+        count = 0;
+    }
+};
+
+// Request latencies kept for percentiles at the end of the run
+class LatencySamples {
+  private:
+    vector<double> samples;
+    
+  public:
+    void add(simtime_t latency) { samples.push_back(latency.dbl()); }
+    
+    double percentile(double p) const {
+        if (samples.empty()) return 0;
+        vector<double> sorted(samples);
+        size_t k = min(sorted.size() - 1, (size_t)ceil(p / 100 * sorted.size()) - (p > 0 ? 1 : 0));
+        nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        return sorted[k];
+    }
+    
+    // <name>Count, <name>P50 and <name>P99
+    void recordScalars(cComponent* module, const string& name) const {
+        module->recordScalar((name + "Count").c_str(), samples.size());
+        module->recordScalar((name + "P50").c_str(), percentile(50));
+        module->recordScalar((name + "P99").c_str(), percentile(99));
+    }
+};
 
 // Priority comparison for queue ordering
 struct MessagePriorityCompare {
@@ -10,17 +10,19 @@ class HTTP : public cSimpleModule {
   private:
     int addr = 0;
     
+    // Per-peer TCP, key and SYN tracking state
+    PeerTable peers;
+    
     // Security
-    map<long, string> sharedKeys;
+    CryptoCostModel cryptoCost;          // CPU time charged for crypto work
+    cMessage* cryptoTimer;               // CPU free again: held packets go out
     string myPublicKey;
     string myPrivateKey;
     
-    // TCP connections
-    map<long, TCPConnection> tcpConnections;
+    // Session resumption (0-RTT)
+    SessionTicketIssuer tickets;
     
     // SYN flood protection
-    map<long, int> synCounts;
-    map<long, simtime_t> synTimestamps;
     double synRateLimit;
     cMessage* synFloodCheckTimer;
     
@@ -28,21 +30,33 @@ class HTTP : public cSimpleModule {
     priority_queue<cMessage*, vector<cMessage*>, MessagePriorityCompare> responseQueue;
     cMessage* sendQueueTimer;
     
-    // Congestion control
-    map<long, double> cwndMap;  // Per-connection congestion window
-    map<long, double> ssthreshMap;
+    // Delayed and coalesced ACKs for data from clients
+    DelayedAckControl acks;
+    cMessage* delayedAckTimer;
     
     // Transmission queue management
     cQueue txQueue;
     cMessage* endTxEvent;
+    PacketPool pool;         // Recycled packets, see mk() and pool.release()
+    SegmentationOffload gso; // Pages leave as one packet, cut into segments at egress
+    PathMtuCache paths;      // Path MTU discovery for the segments
     
   protected:
+    // Pooled packet factory; shadows the global mk() inside this module
+    cPacket* mk(const char* name, int kind, long src, long dst) {
+        return pool.get(name, kind, src, dst);
+    }
+    
     void initialize() override { 
         addr = par("address"); 
         
         // Initialize security
         myPrivateKey = generateECDHPublicKey(addr);
-        myPublicKey = generateECDHPublicKey(addr * 2);
+        myPublicKey = deriveECDHPublicKey(myPrivateKey);
+        cryptoCost.configure(this);
+        cryptoTimer = new cMessage("crypto");
+        peers.configure(this);
+        tickets.configure(this, myPrivateKey);
         
         // SYN flood protection
         synRateLimit = par("synRateLimit").doubleValue();
@@ -51,10 +65,15 @@ class HTTP : public cSimpleModule {
         
         // Queue processing
         sendQueueTimer = new cMessage("sendQueue");
+        acks.configure(this);
+        delayedAckTimer = new cMessage("delayedAck");
         
         // Initialize transmission queue
         txQueue.setName("txQueue");
-        endTxEvent = nullptr;
+        endTxEvent = new cMessage("endTx");
+        gso.configure(this);
+        paths.configure(this);
+        gso.paths = &paths;
         
         EV_INFO << "HTTP server " << addr << " initialized\n";
     }
@@ -66,6 +85,13 @@ class HTTP : public cSimpleModule {
         }
         
         int kind = msg->getKind();
+        peers.touch(SRC(msg));  // Keep active peers off the idle/eviction end
+        
+        // 0-RTT data carries a resumption ticket instead of a fresh handshake
+        if (msg->hasPar("ticket") && !acceptEarlyData(msg)) {
+            pool.release(msg);
+            return;
+        }
         
         switch (kind) {
             case KEY_EXCHANGE:
@@ -83,6 +109,9 @@ class HTTP : public cSimpleModule {
             case TCP_FIN:
                 handleTCPFin(msg);
                 break;
+            case PACKET_TOO_BIG:
+                handlePacketTooBig(msg);
+                break;
             case HTTP_GET:
                 handleHTTPGet(msg);
                 break;
@@ -91,7 +120,7 @@ class HTTP : public cSimpleModule {
                 break;
             default:
                 EV_WARN << "HTTP unexpected kind=" << kind << "\n";
-                delete msg;
+                pool.release(msg);
         }
     }
     
@@ -99,15 +128,16 @@ class HTTP : public cSimpleModule {
         if (msg == synFloodCheckTimer) {
             // Clear old SYN tracking entries
             simtime_t now = simTime();
-            for (auto it = synTimestamps.begin(); it != synTimestamps.end(); ) {
-                if (now - it->second > 60.0) {  // 60 second window
-                    synCounts.erase(it->first);
-                    it = synTimestamps.erase(it);
-                } else {
-                    ++it;
+            peers.forEach([&](PeerState& peer) {
+                if (peer.synCount > 0 && now - peer.synTimestamp > 60.0) {  // 60 second window
+                    peer.synCount = 0;
                 }
-            }
+            });
+            tickets.prune();
+            peers.age();
             scheduleAt(simTime() + 1.0, synFloodCheckTimer);
+        } else if (msg == delayedAckTimer) {
+            acks.flush([&](cMessage* ack) { sendAck(ack); });
         } else if (msg == sendQueueTimer) {
             // Process queued responses
             if (!responseQueue.empty()) {
@@ -121,16 +151,27 @@ class HTTP : public cSimpleModule {
             }
         } else if (msg == endTxEvent) {
             // Transmission finished, send next packet if available
-            endTxEvent = nullptr;
             if (!txQueue.isEmpty()) {
                 cMessage* nextMsg = (cMessage*)txQueue.pop();
                 startTransmission(nextMsg);
             }
+        } else if (msg == cryptoTimer) {
+            cryptoCost.release([&](cMessage* held) { sendPacketOnGate(held); });
+            if (cryptoCost.hasHeld()) scheduleAt(cryptoCost.busyUntil, cryptoTimer);
+        } else if (msg->isPacket()) {
+            // Response released after its service time
+            sendPacketOnGate(msg);
         }
     }
     
     // Transmission queue management functions
     void sendPacketOnGate(cMessage* msg) {
+        // Hold the packet until the CPU has finished pending crypto work
+        if (cryptoCost.hold(msg)) {
+            if (!cryptoTimer->isScheduled()) scheduleAt(max(simTime(), cryptoCost.busyUntil), cryptoTimer);
+            return;
+        }
+        
         cGate* outGate = gate("ppp$o");
         
         // Check if channel is busy
@@ -139,7 +180,7 @@ class HTTP : public cSimpleModule {
             // Channel busy, queue the packet
             txQueue.insert(msg);
             EV_INFO << "HTTP" << addr << " channel busy, queued packet " << msg->getName() << "\n";
-        } else if (endTxEvent != nullptr) {
+        } else if (endTxEvent->isScheduled()) {
             // Already transmitting, queue the packet
             txQueue.insert(msg);
             EV_INFO << "HTTP" << addr << " transmission in progress, queued packet " << msg->getName() << "\n";
@@ -149,21 +190,27 @@ class HTTP : public cSimpleModule {
         }
     }
     
+    // A router could not forward a Don't Fragment segment: remember the
+    // smaller path MTU and resend the segment for the router to fragment
+    void handlePacketTooBig(cMessage* msg) {
+        EV_WARN << "HTTP " << addr << " path MTU to " << msg->par("origDst").longValue()
+                << " is " << msg->par("mtu").longValue() << " (router " << SRC(msg) << ")\n";
+        cPacket* resend = paths.packetTooBig(msg, txQueue);
+        pool.release(msg);
+        if (resend) sendPacketOnGate(resend);
+    }
+    
     void startTransmission(cMessage* msg) {
         cGate* outGate = gate("ppp$o");
+        msg = gso.next(msg, txQueue, pool);
         send(msg, outGate);
         
         // Schedule end of transmission
         cChannel* channel = outGate->getTransmissionChannel();
         simtime_t finishTime = channel->getTransmissionFinishTime();
         
-        if (endTxEvent == nullptr) {
-            endTxEvent = new cMessage("endTx");
-        } else {
-            // Cancel if already scheduled
-            if (endTxEvent->isScheduled()) {
-                cancelEvent(endTxEvent);
-            }
+        if (endTxEvent->isScheduled()) {
+            cancelEvent(endTxEvent);
         }
         scheduleAt(finishTime, endTxEvent);
         EV_INFO << "HTTP" << addr << " started transmission of " << msg->getName() << ", finish at " << finishTime << "\n";
@@ -172,22 +219,59 @@ class HTTP : public cSimpleModule {
     void handleKeyExchange(cMessage* msg) {
         long peerAddr = SRC(msg);
         string peerPublicKey = msg->par("publicKey").stringValue();
+        bool isResponse = msg->hasPar("response") && msg->par("response").boolValue();
         
-        // Compute shared secret
-        string sharedSecret = computeSharedSecret(myPrivateKey, peerPublicKey);
-        sharedKeys[peerAddr] = sharedSecret;
-        
-        // Send our public key back if needed
-        if (sharedKeys.find(peerAddr) == sharedKeys.end() || sharedKeys[peerAddr].empty()) {
+        // Answer handshakes initiated by the peer
+        if (!isResponse) {
+            cryptoCost.chargeEcdh();  // Ephemeral key pair for the response
             auto* response = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, peerAddr);
-            response->addPar("publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "response").setBoolValue(true);
             response->par("priority").setLongValue(PRIORITY_HIGH);
             sendPacketOnGate(response);
         }
         
-        sharedKeys[peerAddr] = sharedSecret;
+        // Compute shared secret only when the peer presents a new public key
+        PeerState& peer = peers.get(peerAddr);
+        if (!peer.hasKey() || peer.peerPublicKey != peerPublicKey) {
+            peer.key = computeSharedSecret(myPrivateKey, peerPublicKey);
+            cryptoCost.chargeEcdh();
+            peer.peerPublicKey = peerPublicKey;
+            sendSessionTicket(peer);
+        }
+        
         EV_INFO << "HTTP " << addr << " completed key exchange with " << peerAddr << "\n";
-        delete msg;
+        pool.release(msg);
+    }
+    
+    void sendSessionTicket(const PeerState& peer) {
+        auto* ticket = mk("SESSION_TICKET", SESSION_TICKET, addr, peer.addr);
+        pool.addPar(ticket, "ticket").setStringValue(tickets.issue(peer.addr, peer.key).c_str());
+        pool.addPar(ticket, "lifetime").setDoubleValue(tickets.lifetime.dbl());
+        ticket->par("priority").setLongValue(PRIORITY_HIGH);
+        sendPacketOnGate(ticket);
+    }
+    
+    // 0-RTT data: on a rejected ticket only the early data is dropped, and
+    // a full handshake replaces the session key
+    bool acceptEarlyData(cMessage* msg) {
+        long src = SRC(msg);
+        cryptoCost.chargeCipher(strlen(msg->par("ticket").stringValue()) / 2);
+        CipherKey earlyKey;
+        if (!tickets.redeem(msg, earlyKey)) {
+            EV_WARN << "HTTP " << addr << " rejected 0-RTT data from " << src << "\n";
+            auto* keyMsg = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, src);
+            pool.addPar(keyMsg, "publicKey").setStringValue(myPublicKey.c_str());
+            keyMsg->par("priority").setLongValue(PRIORITY_HIGH);
+            sendPacketOnGate(keyMsg);
+            return false;
+        }
+        PeerState& peer = peers.get(src);
+        peer.key = earlyKey;
+        peer.peerPublicKey.clear();
+        sendSessionTicket(peer);
+        EV_INFO << "HTTP " << addr << " accepted 0-RTT data from " << src << "\n";
+        return true;
     }
     
     void handleTCPSyn(cMessage* msg) {
@@ -195,14 +279,15 @@ class HTTP : public cSimpleModule {
         long seq = SEQ(msg);
         
         // SYN flood protection using SYN cookies
-        synCounts[src]++;
-        synTimestamps[src] = simTime();
+        PeerState& peer = peers.get(src);
+        peer.synCount++;
+        peer.synTimestamp = simTime();
         
         // Check rate limit
-        if (synCounts[src] > synRateLimit) {
+        if (peer.synCount > synRateLimit) {
             EV_WARN << "HTTP " << addr << " SYN flood detected from " << src 
-                    << ", dropping SYN (count=" << synCounts[src] << ")\n";
-            delete msg;
+                    << ", dropping SYN (count=" << peer.synCount << ")\n";
+            pool.release(msg);
             return;
         }
         
@@ -210,7 +295,7 @@ class HTTP : public cSimpleModule {
         long cookie = msg->par("synCookie").longValue();
         if (!validateSYNCookie(cookie, src, addr, seq)) {
             EV_WARN << "HTTP " << addr << " invalid SYN cookie from " << src << "\n";
-            delete msg;
+            pool.release(msg);
             return;
         }
         
@@ -220,7 +305,7 @@ class HTTP : public cSimpleModule {
         synAck->par("seq").setLongValue(serverSeq);
         synAck->par("ack").setLongValue(seq + 1);
         synAck->par("priority").setLongValue(PRIORITY_HIGH);
-        synAck->addPar("synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
+        pool.addPar(synAck, "synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
         sendPacketOnGate(synAck);
         
         // Create TCP connection state
@@ -231,36 +316,34 @@ class HTTP : public cSimpleModule {
         conn.recvSeq = seq + 1;
         conn.cwnd = 1.0;
         conn.ssthresh = 64.0;
-        tcpConnections[src] = conn;
-        
-        cwndMap[src] = 1.0;
-        ssthreshMap[src] = 64.0;
+        peer.tcp = conn;
         
         EV_INFO << "HTTP " << addr << " sent SYN-ACK to " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPAck(cMessage* msg) {
         long src = SRC(msg);
         
-        auto it = tcpConnections.find(src);
-        if (it != tcpConnections.end()) {
-            if (it->second.state == TCP_SYN_RECEIVED) {
-                it->second.state = TCP_ESTABLISHED;
+        PeerState* peer = peers.find(src);
+        if (peer && peer->hasConnection()) {
+            TCPConnection& conn = peer->tcp;
+            if (conn.state == TCP_SYN_RECEIVED) {
+                conn.state = TCP_ESTABLISHED;
                 EV_INFO << "HTTP " << addr << " TCP connection established with " << src << "\n";
             }
             
             // Update congestion window (AIMD)
-            if (cwndMap[src] < ssthreshMap[src]) {
-                cwndMap[src] *= 2;  // Slow start
+            if (conn.cwnd < conn.ssthresh) {
+                conn.cwnd *= 2;  // Slow start
             } else {
-                cwndMap[src] += 1.0 / cwndMap[src];  // Congestion avoidance
+                conn.cwnd += 1.0 / conn.cwnd;  // Congestion avoidance
             }
             
             EV_INFO << "HTTP " << addr << " received ACK from " << src 
-                    << ", cwnd=" << cwndMap[src] << "\n";
+                    << ", cwnd=" << conn.cwnd << "\n";
         }
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPData(cMessage* msg) {
@@ -271,13 +354,24 @@ class HTTP : public cSimpleModule {
             long src = SRC(msg);
             long seq = SEQ(msg);
             
-            // Send ACK
+            // ACK, delayed until the next segment or the timer
             auto* ack = mk("TCP_ACK", TCP_ACK, addr, src);
             ack->par("ack").setLongValue(seq + 1);
             ack->par("priority").setLongValue(PRIORITY_HIGH);
-            sendPacketOnGate(ack);
+            acks.submit(ack, pool, [&](cMessage* due) { sendAck(due); });
+            if (acks.hasPending() && !delayedAckTimer->isScheduled()) {
+                scheduleAt(simTime() + acks.timeout, delayedAckTimer);
+            }
             
-            delete msg;
+            pool.release(msg);
+        }
+    }
+    
+    void sendAck(cMessage* ack) {
+        if (acks.coalesceQueued(txQueue, ack)) {
+            pool.release(ack);
+        } else {
+            sendPacketOnGate(ack);
         }
     }
     
@@ -290,12 +384,10 @@ class HTTP : public cSimpleModule {
         sendPacketOnGate(finAck);
         
         // Clean up connection state
-        tcpConnections.erase(src);
-        cwndMap.erase(src);
-        ssthreshMap.erase(src);
+        if (PeerState* peer = peers.find(src)) peers.closeConnection(*peer);
         
         EV_INFO << "HTTP " << addr << " closed TCP connection with " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleHTTPGet(cMessage* msg) {
@@ -303,10 +395,12 @@ class HTTP : public cSimpleModule {
         string path = msg->par("path").stringValue();
         bool isEncrypted = msg->hasPar("encrypted") && msg->par("encrypted").boolValue();
         int priority = PRIORITY(msg);
+        PeerState* peer = peers.find(src);
         
         // Decrypt if encrypted
-        if (isEncrypted && sharedKeys.find(src) != sharedKeys.end()) {
-            path = simpleDecrypt(path, sharedKeys[src]);
+        if (isEncrypted && peer && peer->hasKey()) {
+            path = simpleDecrypt(path, peer->key);
+            cryptoCost.chargeCipher(payloadBytes(msg));
         }
         
         EV_INFO << "HTTP " << addr << " received GET request for '" << path 
@@ -317,32 +411,35 @@ class HTTP : public cSimpleModule {
         // Prepare response
         int responseKind = (msg->getKind() == TCP_DATA) ? TCP_DATA : HTTP_RESPONSE;
         auto *resp = mk("HTTP_RESPONSE", responseKind, addr, src);
-        resp->addPar("bytes").setLongValue(par("pageSizeBytes").intValue());
+        pool.addPar(resp, "bytes").setLongValue(par("pageSizeBytes").intValue());
         resp->par("priority").setLongValue(priority);
+        gso.offload(resp, pool);
+        paths.mark(resp, pool);
         
         // Encrypt response if we have shared key
-        if (sharedKeys.find(src) != sharedKeys.end()) {
+        if (peer && peer->hasKey()) {
             string data = "HTTP_DATA";  // Placeholder
-            string encrypted = simpleEncrypt(data, sharedKeys[src]);
-            resp->addPar("encData").setStringValue(encrypted.c_str());
-            resp->addPar("encrypted").setBoolValue(true);
+            string encrypted = simpleEncrypt(data, peer->key);
+            cryptoCost.chargeCipher(payloadBytes(resp));
+            setPayload(pool.addPar(resp, "encData"), encrypted);
+            pool.addPar(resp, "encrypted").setBoolValue(true);
         }
         
         // Set TCP sequence numbers if applicable
         if (responseKind == TCP_DATA) {
-            auto it = tcpConnections.find(src);
-            if (it != tcpConnections.end()) {
-                resp->par("seq").setLongValue(it->second.sendSeq);
-                resp->par("ack").setLongValue(it->second.recvSeq);
-                it->second.sendSeq++;
+            if (peer && peer->hasConnection()) {
+                resp->par("seq").setLongValue(peer->tcp.sendSeq);
+                resp->par("ack").setLongValue(peer->tcp.recvSeq);
+                peer->tcp.sendSeq += gso.segmentCount(resp);
             }
+            acks.piggyback(resp, pool);  // Carries any ACK still held for this client
         }
         
         // Priority-based sending
         double serviceTime = par("serviceTime").doubleValue();
         if (priority >= PRIORITY_HIGH) {
             // High priority: send immediately with reduced service time
-            sendDelayed(resp, SimTime(serviceTime * 0.5), "ppp$o");
+            scheduleAt(simTime() + serviceTime * 0.5, resp);
             EV_INFO << "HTTP " << addr << " sending high-priority response immediately\n";
         } else {
             // Normal/low priority: queue and send with full service time
@@ -353,7 +450,7 @@ class HTTP : public cSimpleModule {
             EV_INFO << "HTTP " << addr << " queued response (priority=" << priority << ")\n";
         }
         
-        delete msg;
+        pool.release(msg);
     }
     
     void handleUDPRequest(cMessage* msg) {
@@ -362,42 +459,57 @@ class HTTP : public cSimpleModule {
             long src = SRC(msg);
             string path = msg->par("path").stringValue();
             bool isEncrypted = msg->hasPar("encrypted") && msg->par("encrypted").boolValue();
+            PeerState* peer = peers.find(src);
             
             // Decrypt if encrypted
-            if (isEncrypted && sharedKeys.find(src) != sharedKeys.end()) {
-                path = simpleDecrypt(path, sharedKeys[src]);
+            if (isEncrypted && peer && peer->hasKey()) {
+                path = simpleDecrypt(path, peer->key);
+                cryptoCost.chargeCipher(payloadBytes(msg));
             }
             
             EV_INFO << "HTTP " << addr << " received UDP GET for '" << path << "'\n";
             
             // Quick UDP response (no reliability, lower latency)
             auto* resp = mk("HTTP_RESPONSE", UDP_DATA, addr, src);
-            resp->addPar("bytes").setLongValue(par("pageSizeBytes").intValue());
+            pool.addPar(resp, "bytes").setLongValue(par("pageSizeBytes").intValue());
             resp->par("priority").setLongValue(PRIORITY(msg));
+            gso.offload(resp, pool);
+            paths.mark(resp, pool);
             
             // Encrypt if key available
-            if (sharedKeys.find(src) != sharedKeys.end()) {
+            if (peer && peer->hasKey()) {
                 string data = "HTTP_UDP_DATA";
-                string encrypted = simpleEncrypt(data, sharedKeys[src]);
-                resp->addPar("encData").setStringValue(encrypted.c_str());
-                resp->addPar("encrypted").setBoolValue(true);
+                string encrypted = simpleEncrypt(data, peer->key);
+                cryptoCost.chargeCipher(payloadBytes(resp));
+                setPayload(pool.addPar(resp, "encData"), encrypted);
+                pool.addPar(resp, "encrypted").setBoolValue(true);
             }
             
             // UDP response sent with minimal delay
-            sendDelayed(resp, SimTime(par("serviceTime").doubleValue() * 0.3), "ppp$o");
+            scheduleAt(simTime() + par("serviceTime").doubleValue() * 0.3, resp);
             EV_INFO << "HTTP " << addr << " sent UDP response\n";
         }
-        delete msg;
+        pool.release(msg);
     }
     
     void finish() override {
         cancelAndDelete(synFloodCheckTimer);
+        
+        tickets.recordScalars(this);
+        cryptoCost.recordScalars(this);
+        cancelAndDelete(cryptoTimer);
+        cryptoCost.clear();
+        pool.recordScalars(this);
+        peers.recordScalars(this);
+        gso.recordScalars(this);
+        paths.recordScalars(this);
         cancelAndDelete(sendQueueTimer);
+        cancelAndDelete(delayedAckTimer);
+        acks.recordScalars(this);
+        acks.clear();
         
         // Clean up transmission queue
-        if (endTxEvent != nullptr) {
-            cancelAndDelete(endTxEvent);
-        }
+        cancelAndDelete(endTxEvent);
         while (!txQueue.isEmpty()) {
             delete txQueue.pop();
         }
@@ -9,17 +9,19 @@ class MailServer : public cSimpleModule {
   private:
     int addr = 0;
     
+    // Per-peer TCP, key and SYN tracking state
+    PeerTable peers;
+    
     // Security
-    map<long, string> sharedKeys;
+    CryptoCostModel cryptoCost;          // CPU time charged for crypto work
+    cMessage* cryptoTimer;               // CPU free again: held packets go out
     string myPublicKey;
     string myPrivateKey;
     
-    // TCP connections
-    map<long, TCPConnection> tcpConnections;
+    // Session resumption (0-RTT)
+    SessionTicketIssuer tickets;
     
     // SYN flood protection
-    map<long, int> synCounts;
-    map<long, simtime_t> synTimestamps;
     double synRateLimit;
     cMessage* synFloodCheckTimer;
     
@@ -27,21 +29,27 @@ class MailServer : public cSimpleModule {
     priority_queue<cMessage*, vector<cMessage*>, MessagePriorityCompare> mailQueue;
     cMessage* processMailTimer;
     
-    // Congestion control
-    map<long, double> cwndMap;
-    map<long, double> ssthreshMap;
-    
     // Transmission queue management
     cQueue txQueue;
     cMessage* endTxEvent;
+    PacketPool pool;         // Recycled packets, see mk() and pool.release()
     
   protected:
+    // Pooled packet factory; shadows the global mk() inside this module
+    cPacket* mk(const char* name, int kind, long src, long dst) {
+        return pool.get(name, kind, src, dst);
+    }
+    
     void initialize() override {
         addr = par("address");
         
         // Initialize security
         myPrivateKey = generateECDHPublicKey(addr);
-        myPublicKey = generateECDHPublicKey(addr * 2);
+        myPublicKey = deriveECDHPublicKey(myPrivateKey);
+        cryptoCost.configure(this);
+        cryptoTimer = new cMessage("crypto");
+        peers.configure(this);
+        tickets.configure(this, myPrivateKey);
         
         // SYN flood protection
         synRateLimit = par("synRateLimit").doubleValue();
@@ -53,7 +61,7 @@ class MailServer : public cSimpleModule {
         
         // Initialize transmission queue
         txQueue.setName("txQueue");
-        endTxEvent = nullptr;
+        endTxEvent = new cMessage("endTx");
         
         EV_INFO << "Mail server " << addr << " initialized\n";
     }
@@ -65,6 +73,13 @@ class MailServer : public cSimpleModule {
         }
         
         int kind = msg->getKind();
+        peers.touch(SRC(msg));  // Keep active peers off the idle/eviction end
+        
+        // 0-RTT data carries a resumption ticket instead of a fresh handshake
+        if (msg->hasPar("ticket") && !acceptEarlyData(msg)) {
+            pool.release(msg);
+            return;
+        }
         
         switch (kind) {
             case KEY_EXCHANGE:
@@ -84,7 +99,7 @@ class MailServer : public cSimpleModule {
                 break;
             default:
                 EV_WARN << "MailServer " << addr << " unexpected kind=" << kind << "\n";
-                delete msg;
+                pool.release(msg);
         }
     }
     
@@ -92,14 +107,13 @@ class MailServer : public cSimpleModule {
         if (msg == synFloodCheckTimer) {
             // Clear old SYN tracking entries
             simtime_t now = simTime();
-            for (auto it = synTimestamps.begin(); it != synTimestamps.end(); ) {
-                if (now - it->second > 60.0) {
-                    synCounts.erase(it->first);
-                    it = synTimestamps.erase(it);
-                } else {
-                    ++it;
+            peers.forEach([&](PeerState& peer) {
+                if (peer.synCount > 0 && now - peer.synTimestamp > 60.0) {
+                    peer.synCount = 0;
                 }
-            }
+            });
+            tickets.prune();
+            peers.age();
             scheduleAt(simTime() + 1.0, synFloodCheckTimer);
         } else if (msg == processMailTimer) {
             // Process queued mail
@@ -114,16 +128,27 @@ class MailServer : public cSimpleModule {
             }
         } else if (msg == endTxEvent) {
             // Transmission finished, send next packet if available
-            endTxEvent = nullptr;
             if (!txQueue.isEmpty()) {
                 cMessage* nextMsg = (cMessage*)txQueue.pop();
                 startTransmission(nextMsg);
             }
+        } else if (msg == cryptoTimer) {
+            cryptoCost.release([&](cMessage* held) { sendPacketOnGate(held); });
+            if (cryptoCost.hasHeld()) scheduleAt(cryptoCost.busyUntil, cryptoTimer);
+        } else if (msg->isPacket()) {
+            // Response released after its service time
+            sendPacketOnGate(msg);
         }
     }
     
     // Transmission queue management functions
     void sendPacketOnGate(cMessage* msg) {
+        // Hold the packet until the CPU has finished pending crypto work
+        if (cryptoCost.hold(msg)) {
+            if (!cryptoTimer->isScheduled()) scheduleAt(max(simTime(), cryptoCost.busyUntil), cryptoTimer);
+            return;
+        }
+        
         cGate* outGate = gate("ppp$o");
         
         // Check if channel is busy
@@ -132,7 +157,7 @@ class MailServer : public cSimpleModule {
             // Channel busy, queue the packet
             txQueue.insert(msg);
             EV_INFO << "Mail" << addr << " channel busy, queued packet " << msg->getName() << "\n";
-        } else if (endTxEvent != nullptr) {
+        } else if (endTxEvent->isScheduled()) {
             // Already transmitting, queue the packet
             txQueue.insert(msg);
             EV_INFO << "Mail" << addr << " transmission in progress, queued packet " << msg->getName() << "\n";
@@ -150,13 +175,8 @@ class MailServer : public cSimpleModule {
         cChannel* channel = outGate->getTransmissionChannel();
         simtime_t finishTime = channel->getTransmissionFinishTime();
         
-        if (endTxEvent == nullptr) {
-            endTxEvent = new cMessage("endTx");
-        } else {
-            // Cancel if already scheduled
-            if (endTxEvent->isScheduled()) {
-                cancelEvent(endTxEvent);
-            }
+        if (endTxEvent->isScheduled()) {
+            cancelEvent(endTxEvent);
         }
         scheduleAt(finishTime, endTxEvent);
         EV_INFO << "Mail" << addr << " started transmission of " << msg->getName() << ", finish at " << finishTime << "\n";
@@ -165,22 +185,59 @@ class MailServer : public cSimpleModule {
     void handleKeyExchange(cMessage* msg) {
         long peerAddr = SRC(msg);
         string peerPublicKey = msg->par("publicKey").stringValue();
+        bool isResponse = msg->hasPar("response") && msg->par("response").boolValue();
         
-        // Compute shared secret
-        string sharedSecret = computeSharedSecret(myPrivateKey, peerPublicKey);
-        sharedKeys[peerAddr] = sharedSecret;
-        
-        // Send our public key back if needed
-        if (sharedKeys.find(peerAddr) == sharedKeys.end() || sharedKeys[peerAddr].empty()) {
+        // Answer handshakes initiated by the peer
+        if (!isResponse) {
+            cryptoCost.chargeEcdh();  // Ephemeral key pair for the response
             auto* response = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, peerAddr);
-            response->addPar("publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "response").setBoolValue(true);
             response->par("priority").setLongValue(PRIORITY_HIGH);
             sendPacketOnGate(response);
         }
         
-        sharedKeys[peerAddr] = sharedSecret;
+        // Compute shared secret only when the peer presents a new public key
+        PeerState& peer = peers.get(peerAddr);
+        if (!peer.hasKey() || peer.peerPublicKey != peerPublicKey) {
+            peer.key = computeSharedSecret(myPrivateKey, peerPublicKey);
+            cryptoCost.chargeEcdh();
+            peer.peerPublicKey = peerPublicKey;
+            sendSessionTicket(peer);
+        }
+        
         EV_INFO << "MailServer " << addr << " completed key exchange with " << peerAddr << "\n";
-        delete msg;
+        pool.release(msg);
+    }
+    
+    void sendSessionTicket(const PeerState& peer) {
+        auto* ticket = mk("SESSION_TICKET", SESSION_TICKET, addr, peer.addr);
+        pool.addPar(ticket, "ticket").setStringValue(tickets.issue(peer.addr, peer.key).c_str());
+        pool.addPar(ticket, "lifetime").setDoubleValue(tickets.lifetime.dbl());
+        ticket->par("priority").setLongValue(PRIORITY_HIGH);
+        sendPacketOnGate(ticket);
+    }
+    
+    // 0-RTT data: on a rejected ticket only the early data is dropped, and
+    // a full handshake replaces the session key
+    bool acceptEarlyData(cMessage* msg) {
+        long src = SRC(msg);
+        cryptoCost.chargeCipher(strlen(msg->par("ticket").stringValue()) / 2);
+        CipherKey earlyKey;
+        if (!tickets.redeem(msg, earlyKey)) {
+            EV_WARN << "MailServer " << addr << " rejected 0-RTT data from " << src << "\n";
+            auto* keyMsg = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, src);
+            pool.addPar(keyMsg, "publicKey").setStringValue(myPublicKey.c_str());
+            keyMsg->par("priority").setLongValue(PRIORITY_HIGH);
+            sendPacketOnGate(keyMsg);
+            return false;
+        }
+        PeerState& peer = peers.get(src);
+        peer.key = earlyKey;
+        peer.peerPublicKey.clear();
+        sendSessionTicket(peer);
+        EV_INFO << "MailServer " << addr << " accepted 0-RTT data from " << src << "\n";
+        return true;
     }
     
     void handleTCPSyn(cMessage* msg) {
@@ -188,12 +245,13 @@ class MailServer : public cSimpleModule {
         long seq = SEQ(msg);
         
         // SYN flood protection
-        synCounts[src]++;
-        synTimestamps[src] = simTime();
+        PeerState& peer = peers.get(src);
+        peer.synCount++;
+        peer.synTimestamp = simTime();
         
-        if (synCounts[src] > synRateLimit) {
+        if (peer.synCount > synRateLimit) {
             EV_WARN << "MailServer " << addr << " SYN flood from " << src << "\n";
-            delete msg;
+            pool.release(msg);
             return;
         }
         
@@ -201,7 +259,7 @@ class MailServer : public cSimpleModule {
         long cookie = msg->par("synCookie").longValue();
         if (!validateSYNCookie(cookie, src, addr, seq)) {
             EV_WARN << "MailServer " << addr << " invalid SYN cookie from " << src << "\n";
-            delete msg;
+            pool.release(msg);
             return;
         }
         
@@ -211,7 +269,7 @@ class MailServer : public cSimpleModule {
         synAck->par("seq").setLongValue(serverSeq);
         synAck->par("ack").setLongValue(seq + 1);
         synAck->par("priority").setLongValue(PRIORITY_HIGH);
-        synAck->addPar("synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
+        pool.addPar(synAck, "synCookie").setLongValue(generateSYNCookie(addr, src, serverSeq));
         sendPacketOnGate(synAck);
         
         // Create TCP connection
@@ -222,33 +280,31 @@ class MailServer : public cSimpleModule {
         conn.recvSeq = seq + 1;
         conn.cwnd = 1.0;
         conn.ssthresh = 64.0;
-        tcpConnections[src] = conn;
-        
-        cwndMap[src] = 1.0;
-        ssthreshMap[src] = 64.0;
+        peer.tcp = conn;
         
         EV_INFO << "MailServer " << addr << " sent SYN-ACK to " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPAck(cMessage* msg) {
         long src = SRC(msg);
         
-        auto it = tcpConnections.find(src);
-        if (it != tcpConnections.end()) {
-            if (it->second.state == TCP_SYN_RECEIVED) {
-                it->second.state = TCP_ESTABLISHED;
+        PeerState* peer = peers.find(src);
+        if (peer && peer->hasConnection()) {
+            TCPConnection& conn = peer->tcp;
+            if (conn.state == TCP_SYN_RECEIVED) {
+                conn.state = TCP_ESTABLISHED;
                 EV_INFO << "MailServer " << addr << " connection established with " << src << "\n";
             }
             
             // Update congestion window
-            if (cwndMap[src] < ssthreshMap[src]) {
-                cwndMap[src] *= 2;
+            if (conn.cwnd < conn.ssthresh) {
+                conn.cwnd *= 2;
             } else {
-                cwndMap[src] += 1.0 / cwndMap[src];
+                conn.cwnd += 1.0 / conn.cwnd;
             }
         }
-        delete msg;
+        pool.release(msg);
     }
     
     void handleTCPFin(cMessage* msg) {
@@ -260,18 +316,21 @@ class MailServer : public cSimpleModule {
         sendPacketOnGate(finAck);
         
         // Clean up connection state
-        tcpConnections.erase(src);
-        cwndMap.erase(src);
-        ssthreshMap.erase(src);
+        if (PeerState* peer = peers.find(src)) peers.closeConnection(*peer);
         
         EV_INFO << "MailServer " << addr << " closed connection with " << src << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleMailRequest(cMessage* msg) {
         long src = SRC(msg);
         bool isEncrypted = msg->hasPar("encrypted") && msg->par("encrypted").boolValue();
         int priority = PRIORITY(msg);
+        PeerState* peer = peers.find(src);
+        
+        if (isEncrypted) {
+            cryptoCost.chargeCipher(payloadBytes(msg));
+        }
         
         EV_INFO << "MailServer " << addr << " received mail request from " << src;
         if (isEncrypted) EV_INFO << " (encrypted)";
@@ -279,29 +338,29 @@ class MailServer : public cSimpleModule {
         
         // Prepare mail response
         auto* resp = mk("MAIL_RESPONSE", TCP_DATA, addr, src);
-        resp->addPar("bytes").setLongValue(par("mailSizeBytes").intValue());
+        pool.addPar(resp, "bytes").setLongValue(par("mailSizeBytes").intValue());
         resp->par("priority").setLongValue(priority);
         
         // Encrypt if we have shared key
-        if (sharedKeys.find(src) != sharedKeys.end()) {
+        if (peer && peer->hasKey()) {
             string mailData = "MAIL_CONTENT";
-            string encrypted = simpleEncrypt(mailData, sharedKeys[src]);
-            resp->addPar("encData").setStringValue(encrypted.c_str());
-            resp->addPar("encrypted").setBoolValue(true);
+            string encrypted = simpleEncrypt(mailData, peer->key);
+            cryptoCost.chargeCipher(payloadBytes(resp));
+            setPayload(pool.addPar(resp, "encData"), encrypted);
+            pool.addPar(resp, "encrypted").setBoolValue(true);
         }
         
         // Set TCP sequence numbers
-        auto it = tcpConnections.find(src);
-        if (it != tcpConnections.end()) {
-            resp->par("seq").setLongValue(it->second.sendSeq);
-            resp->par("ack").setLongValue(it->second.recvSeq);
-            it->second.sendSeq++;
+        if (peer && peer->hasConnection()) {
+            resp->par("seq").setLongValue(peer->tcp.sendSeq);
+            resp->par("ack").setLongValue(peer->tcp.recvSeq);
+            peer->tcp.sendSeq++;
         }
         
         // Priority-based sending
         double serviceTime = par("serviceTime").doubleValue();
         if (priority >= PRIORITY_HIGH) {
-            sendDelayed(resp, SimTime(serviceTime * 0.7), "ppp$o");
+            scheduleAt(simTime() + serviceTime * 0.7, resp);
         } else {
             mailQueue.push(resp);
             if (!processMailTimer->isScheduled()) {
@@ -309,17 +368,22 @@ class MailServer : public cSimpleModule {
             }
         }
         
-        delete msg;
+        pool.release(msg);
     }
     
     void finish() override {
         cancelAndDelete(synFloodCheckTimer);
+        
+        tickets.recordScalars(this);
+        cryptoCost.recordScalars(this);
+        cancelAndDelete(cryptoTimer);
+        cryptoCost.clear();
+        pool.recordScalars(this);
+        peers.recordScalars(this);
         cancelAndDelete(processMailTimer);
         
         // Clean up transmission queue
-        if (endTxEvent != nullptr) {
-            cancelAndDelete(endTxEvent);
-        }
+        cancelAndDelete(endTxEvent);
         while (!txQueue.isEmpty()) {
             delete txQueue.pop();
         }
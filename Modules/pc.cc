@@ -15,12 +15,24 @@ class PC : public cSimpleModule {
     
     // TCP/UDP Hybrid Protocol
     string protocol;  // "TCP" or "UDP" or "AUTO"
-    map<long, TCPConnection> tcpConnections;
+    
+    // Per-server TCP, key and resumption ticket state
+    PeerTable peers;
     
     // Security (ECDH + AES)
     string myPublicKey;
     string myPrivateKey;
-    map<long, string> sharedKeys;
+    CryptoCostModel cryptoCost;          // CPU time charged for crypto work
+    cMessage* cryptoTimer;               // CPU free again: held packets go out
+    
+    // Session resumption: tickets outlive the session that earned them
+    bool sessionResumption;
+    double repeatInterval;
+    long fullHandshakes = 0;
+    long resumedHandshakes = 0;
+    long earlyDataResent = 0;  // Rejected 0-RTT sends repeated after the handshake
+    long networkErrors = 0;  // DEST_UNREACHABLE / TIME_EXCEEDED received
+    long segmentsReceived = 0; // Leading segments of offloaded sends, ACKed only
     
     // Congestion control
     double cwnd;           // Congestion window
@@ -33,12 +45,79 @@ class PC : public cSimpleModule {
     // Transmission queue management (to prevent channel busy errors)
     cQueue txQueue;
     cMessage* endTxEvent;
+    PacketPool pool;         // Recycled packets, see mk() and pool.release()
     
     // Timers
     cMessage* retransmitTimer;
     cMessage* congestionTimer;
+    
+    // Receiver side: delayed and coalesced ACKs
+    DelayedAckControl acks;
+    cMessage* delayedAckTimer;
+    ReceiveCoalescing gro;   // In-order segments merged into one delivery
+    cMessage* groTimer;
+    cMessage* reassemblyTimer;    // Oldest incomplete datagram times out
+    ReassemblyBuffer reassembly;  // Fragments from routers on smaller-MTU links
+    map<long, long> ceReceived;   // peer -> CE-marked segments, echoed in ACKs
+    long ceMarksReceived = 0;
+    
+    // Request latency: DNS query to answer, HTTP request to response
+    simtime_t dnsSentAt = -1;    // -1 = nothing outstanding
+    simtime_t httpSentAt = -1;
+    LatencySamples dnsLatency;
+    LatencySamples httpLatency;
+    cOutVector dnsLatencyVector;
+    cOutVector httpLatencyVector;
+    
+    // Video streaming (application = "VIDEO")
+    string application;      // "WEB" (DNS/HTTP/DB sequence) or "VIDEO"
+    long videoServerAddr;
+    AbrController abr;
+    int videoSegments;       // Segments per session
+    double startupBuffer;    // Seconds buffered before playback starts
+    double segmentTimeout;
+    int nextSegment = 0;     // Next segment to request
+    int videoQuality = -1;   // Quality index of the segment in flight
+    int playedQuality = -1;  // Quality of the last completed segment
+    long segmentBytes = 0;   // Requested size of the segment in flight
+    long segmentChunks = 0;
+    long chunksReceived = 0;     // Distinct chunks of the segment in flight
+    long nextChunk = 0;          // First chunk not yet received; what video ACKs carry
+    vector<bool> chunkSeen;      // Received chunks of the segment in flight, by "seq"
+    long videoRequest = 0;       // Attempt id; a retry gets a new one
+    simtime_t segmentRequested;
+    double bufferLevel = 0;  // Seconds of video buffered at bufferUpdated
+    simtime_t bufferUpdated;
+    bool playing = false;
+    bool stalled = false;
+    simtime_t sessionStart;
+    simtime_t stallStart;
+    cMessage* videoRequestEvt;   // Buffer has room for the next segment
+    cMessage* videoStallEvt;     // Buffer runs dry
+    cMessage* videoTimeoutEvt;   // Segment download took too long
+    
+    // Video QoE
+    long videoSessions = 0;
+    long startups = 0;
+    double startupDelayTotal = 0;
+    long rebufferCount = 0;
+    double rebufferTime = 0;
+    double playedTime = 0;
+    long segmentsDownloaded = 0;
+    double bitrateTotal = 0;
+    long bitrateSwitches = 0;
+    long segmentTimeouts = 0;
+    cOutVector bitrateVector;
+    cOutVector bufferVector;
+    cOutVector throughputVector;
+    cOutVector startupDelayVector;
 
   protected:
+    // Pooled packet factory; shadows the global mk() inside this module
+    cPacket* mk(const char* name, int kind, long src, long dst) {
+        return pool.get(name, kind, src, dst);
+    }
+    
     void initialize() override {
         addr    = par("address");
         dnsAddr = par("dnsAddr");
@@ -47,7 +126,11 @@ class PC : public cSimpleModule {
         
         // Initialize security
         myPrivateKey = generateECDHPublicKey(addr);
-        myPublicKey = generateECDHPublicKey(addr * 2);
+        myPublicKey = deriveECDHPublicKey(myPrivateKey);
+        cryptoCost.configure(this);
+        cryptoTimer = new cMessage("crypto");
+        sessionResumption = par("sessionResumption").boolValue();
+        repeatInterval = par("repeatInterval").doubleValue();
         
         // Initialize congestion control
         cwnd = 1.0;
@@ -57,10 +140,34 @@ class PC : public cSimpleModule {
         // Initialize timers
         retransmitTimer = new cMessage("retransmit");
         congestionTimer = new cMessage("congestion");
+        acks.configure(this);
+        delayedAckTimer = new cMessage("delayedAck");
+        gro.configure(this);
+        groTimer = new cMessage("gro");
+        reassembly.configure(this);
+        reassemblyTimer = new cMessage("reassembly");
+        
+        // Video client
+        application = par("application").stdstringValue();
+        videoServerAddr = par("videoServerAddr");
+        abr.configure(par("abrAlgorithm").stdstringValue(), par("videoBitrates").stdstringValue(),
+                      par("segmentDuration").doubleValue(), par("maxBuffer").doubleValue());
+        videoSegments = par("videoSegments");
+        startupBuffer = par("startupBuffer").doubleValue();
+        segmentTimeout = par("segmentTimeout").doubleValue();
+        videoRequestEvt = new cMessage("videoRequest");
+        videoStallEvt = new cMessage("videoStall");
+        videoTimeoutEvt = new cMessage("videoTimeout");
+        bitrateVector.setName("videoBitrate");
+        bufferVector.setName("videoBuffer");
+        throughputVector.setName("videoThroughput");
+        startupDelayVector.setName("videoStartupDelay");
+        dnsLatencyVector.setName("dnsLatency");
+        httpLatencyVector.setName("httpLatency");
         
         // Initialize transmission queue
         txQueue.setName("txQueue");
-        endTxEvent = nullptr;
+        endTxEvent = new cMessage("endTx");
         
         startEvt = new cMessage("start");
         scheduleAt(simTime() + SimTime(par("startAt").doubleValue()), startEvt);
@@ -73,6 +180,27 @@ class PC : public cSimpleModule {
             return;
         }
 
+        if (msg->hasPar("fragId")) {
+            msg = reassembly.add(msg, pool);
+            cancelEvent(reassemblyTimer);
+            if (reassembly.hasPending()) {
+                scheduleAt(reassembly.nextDeadline(), reassemblyTimer);
+            }
+            if (!msg) return;  // Wait for the remaining fragments
+        }
+        
+        int kind = msg->getKind();
+        if (kind == TCP_DATA || kind == VIDEO_CHUNK || msg->hasPar("segOffset")) {
+            gro.receive(msg, pool, [&](cMessage* run, int segments) { deliverData(run, segments); });
+            if (gro.hasPending() && !groTimer->isScheduled()) {
+                scheduleAt(gro.nextDeadline(), groTimer);
+            }
+            return;
+        }
+        handlePacket(msg);
+    }
+    
+    void handlePacket(cMessage* msg) {
         int kind = msg->getKind();
         
         switch (kind) {
@@ -112,22 +240,60 @@ class PC : public cSimpleModule {
                 handleKeyExchange(msg);
                 break;
             }
+            case SESSION_TICKET: {
+                handleSessionTicket(msg);
+                break;
+            }
             case ENCRYPTED_DATA: {
                 handleEncryptedData(msg);
                 break;
             }
+            case VIDEO_CHUNK: {
+                handleVideoChunk(msg);
+                break;
+            }
+            case DEST_UNREACHABLE:
+            case TIME_EXCEEDED: {
+                // Retransmission timers recover; just account for the loss
+                networkErrors++;
+                EV_WARN << "PC" << addr << " " << msg->getName() << " from router " << SRC(msg)
+                        << " for packet kind=" << msg->par("origKind").longValue() << " to "
+                        << msg->par("origDst").longValue() << "\n";
+                pool.release(msg);
+                break;
+            }
             default:
                 EV_WARN << "PC" << addr << " unexpected kind=" << kind << "\n";
-                delete msg;
+                pool.release(msg);
         }
     }
     
     void handleSelfMessage(cMessage* msg) {
         if (msg == startEvt) {
+            // Each run of the request sequence is a fresh session; only the
+            // resumption tickets carry over
+            peers.forEach([](PeerState& peer) {
+                peer.tcp = TCPConnection();
+                peer.key = CipherKey();
+                peer.peerPublicKey.clear();
+                peer.earlyTicket.clear();
+                peer.earlyNonce.clear();
+                peer.earlyResend = nullptr;
+            });
+            if (repeatInterval > 0) {
+                scheduleAt(simTime() + repeatInterval, startEvt);
+            }
+            
+            if (application == "VIDEO") {
+                startVideoSession();
+                return;
+            }
+            
             // Step 1: Initiate key exchange
             initiateKeyExchange(dnsAddr);
             
             // Step 2: Send DNS query (choose protocol based on setting)
+            dnsSentAt = simTime();
             if (protocol == "UDP" || protocol == "AUTO") {
                 sendDNSQueryUDP();
             } else {
@@ -137,18 +303,44 @@ class PC : public cSimpleModule {
             handleRetransmit();
         } else if (msg == congestionTimer) {
             handleCongestionTimeout();
+        } else if (msg == delayedAckTimer) {
+            acks.flush([&](cMessage* ack) { sendAck(ack); });
+        } else if (msg == groTimer) {
+            gro.flushExpired([&](cMessage* run, int segments) { deliverData(run, segments); });
+            if (gro.hasPending()) {
+                scheduleAt(gro.nextDeadline(), groTimer);
+            }
+        } else if (msg == reassemblyTimer) {
+            reassembly.expire(pool);
+            if (reassembly.hasPending()) {
+                scheduleAt(reassembly.nextDeadline(), reassemblyTimer);
+            }
+        } else if (msg == videoRequestEvt) {
+            requestSegment();
+        } else if (msg == videoStallEvt) {
+            handleBufferEmpty();
+        } else if (msg == videoTimeoutEvt) {
+            handleSegmentTimeout();
         } else if (msg == endTxEvent) {
             // Transmission finished, send next packet if available
-            endTxEvent = nullptr;
             if (!txQueue.isEmpty()) {
                 cMessage* nextMsg = (cMessage*)txQueue.pop();
                 startTransmission(nextMsg);
             }
+        } else if (msg == cryptoTimer) {
+            cryptoCost.release([&](cMessage* held) { sendPacketOnGate(held); });
+            if (cryptoCost.hasHeld()) scheduleAt(cryptoCost.busyUntil, cryptoTimer);
         }
     }
     
     // Transmission queue management functions
     void sendPacketOnGate(cMessage* msg) {
+        // Hold the packet until the CPU has finished pending crypto work
+        if (cryptoCost.hold(msg)) {
+            if (!cryptoTimer->isScheduled()) scheduleAt(max(simTime(), cryptoCost.busyUntil), cryptoTimer);
+            return;
+        }
+        
         cGate* outGate = gate("ppp$o");
         
         // Check if channel is busy
@@ -157,7 +349,7 @@ class PC : public cSimpleModule {
             // Channel busy, queue the packet
             txQueue.insert(msg);
             EV_INFO << "PC" << addr << " channel busy, queued packet " << msg->getName() << "\n";
-        } else if (endTxEvent != nullptr) {
+        } else if (endTxEvent->isScheduled()) {
             // Already transmitting, queue the packet
             txQueue.insert(msg);
             EV_INFO << "PC" << addr << " transmission in progress, queued packet " << msg->getName() << "\n";
@@ -175,42 +367,105 @@ class PC : public cSimpleModule {
         cChannel* channel = outGate->getTransmissionChannel();
         simtime_t finishTime = channel->getTransmissionFinishTime();
         
-        if (endTxEvent == nullptr) {
-            endTxEvent = new cMessage("endTx");
-        } else {
-            // Cancel if already scheduled
-            if (endTxEvent->isScheduled()) {
-                cancelEvent(endTxEvent);
-            }
+        if (endTxEvent->isScheduled()) {
+            cancelEvent(endTxEvent);
         }
         scheduleAt(finishTime, endTxEvent);
         EV_INFO << "PC" << addr << " started transmission of " << msg->getName() << ", finish at " << finishTime << "\n";
     }
     
     void initiateKeyExchange(long peerAddr) {
+        PeerState& peer = peers.get(peerAddr);
+        if (peer.hasKey()) {
+            return;  // Already keyed in this session
+        }
+        
+        // Resume with a ticket: the key is available at once and the first
+        // data packet carries the ticket (0-RTT), so no handshake round trip
+        SessionTicket& t = peer.ticket;
+        if (sessionResumption && !t.ticket.empty() && simTime() - t.issued < t.lifetime) {
+            string nonce = to_string(intuniform(0, 0x7FFFFFFF));
+            peer.key = deriveSessionKey(t.resumptionSecret, "early:" + nonce);
+            peer.earlyTicket = t.ticket;
+            peer.earlyNonce = nonce;
+            t = SessionTicket();  // Tickets are single-use
+            resumedHandshakes++;
+            EV_INFO << "PC" << addr << " resuming session with " << peerAddr << " (0-RTT)\n";
+            return;
+        }
+        
+        cryptoCost.chargeEcdh();  // Ephemeral key pair
         auto* keyMsg = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, peerAddr);
-        keyMsg->addPar("publicKey").setStringValue(myPublicKey.c_str());
+        pool.addPar(keyMsg, "publicKey").setStringValue(myPublicKey.c_str());
         keyMsg->par("priority").setLongValue(PRIORITY_HIGH);
         sendPacketOnGate(keyMsg);
+        fullHandshakes++;
         EV_INFO << "PC" << addr << " initiated key exchange with " << peerAddr << "\n";
     }
     
     void handleKeyExchange(cMessage* msg) {
         long peerAddr = SRC(msg);
         string peerPublicKey = msg->par("publicKey").stringValue();
+        bool isResponse = msg->hasPar("response") && msg->par("response").boolValue();
         
-        // Compute shared secret
-        string sharedSecret = computeSharedSecret(myPrivateKey, peerPublicKey);
-        sharedKeys[peerAddr] = sharedSecret;
+        // Compute shared secret only when the peer presents a new public key
+        PeerState& peer = peers.get(peerAddr);
+        if (!peer.hasKey() || peer.peerPublicKey != peerPublicKey) {
+            peer.key = computeSharedSecret(myPrivateKey, peerPublicKey);
+            cryptoCost.chargeEcdh();
+            peer.peerPublicKey = peerPublicKey;
+        }
         
-        // Send our public key back
-        auto* response = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, peerAddr);
-        response->addPar("publicKey").setStringValue(myPublicKey.c_str());
-        response->par("priority").setLongValue(PRIORITY_HIGH);
-        sendPacketOnGate(response);
+        // Send our public key back if the server started the handshake
+        // (e.g. after rejecting our 0-RTT data)
+        if (!isResponse) {
+            cryptoCost.chargeEcdh();  // Ephemeral key pair for the response
+            auto* response = mk("KEY_EXCHANGE", KEY_EXCHANGE, addr, peerAddr);
+            pool.addPar(response, "publicKey").setStringValue(myPublicKey.c_str());
+            pool.addPar(response, "response").setBoolValue(true);
+            response->par("priority").setLongValue(PRIORITY_HIGH);
+            sendPacketOnGate(response);
+            
+            // Our 0-RTT data was dropped: send it again under the new key
+            if (peer.earlyResend) {
+                function<void()> resend;
+                resend.swap(peer.earlyResend);
+                earlyDataResent++;
+                EV_INFO << "PC" << addr << " resending rejected 0-RTT data to " << peerAddr << "\n";
+                resend();
+            }
+        }
         
         EV_INFO << "PC" << addr << " completed key exchange with " << peerAddr << "\n";
-        delete msg;
+        pool.release(msg);
+    }
+    
+    void handleSessionTicket(cMessage* msg) {
+        long peerAddr = SRC(msg);
+        PeerState* peer = peers.find(peerAddr);
+        if (peer && peer->hasKey()) {
+            SessionTicket& ticket = peer->ticket;
+            ticket.ticket = msg->par("ticket").stringValue();
+            ticket.resumptionSecret = deriveSessionKey(peer->key.key, "resumption");
+            ticket.issued = simTime();
+            ticket.lifetime = msg->par("lifetime").doubleValue();
+            peer->earlyResend = nullptr;  // A new ticket means the early data was accepted
+            EV_INFO << "PC" << addr << " stored session ticket from " << peerAddr << "\n";
+        }
+        pool.release(msg);
+    }
+    
+    // Present the resumption ticket on the first data packet to a server.
+    // resend repeats the send as ordinary data if the server rejects it.
+    void attachEarlyData(cMessage* msg, long peerAddr, function<void()> resend) {
+        PeerState* peer = peers.find(peerAddr);
+        if (peer && peer->hasEarlyData()) {
+            pool.addPar(msg, "ticket").setStringValue(peer->earlyTicket.c_str());
+            pool.addPar(msg, "ticketNonce").setStringValue(peer->earlyNonce.c_str());
+            peer->earlyTicket.clear();
+            peer->earlyNonce.clear();
+            peer->earlyResend = resend;
+        }
     }
     
     void sendDNSQueryTCP() {
@@ -220,14 +475,14 @@ class PC : public cSimpleModule {
         auto* syn = mk("TCP_SYN", TCP_SYN, addr, dnsAddr);
         syn->par("seq").setLongValue(seq);
         syn->par("priority").setLongValue(PRIORITY_HIGH);
-        syn->addPar("synCookie").setLongValue(generateSYNCookie(addr, dnsAddr, seq));
+        pool.addPar(syn, "synCookie").setLongValue(generateSYNCookie(addr, dnsAddr, seq));
         
         TCPConnection conn;
         conn.remoteAddr = dnsAddr;
         conn.state = TCP_SYN_SENT;
         conn.sendSeq = seq + 1;
         conn.lastSent = simTime();
-        tcpConnections[dnsAddr] = conn;
+        peers.get(dnsAddr).tcp = conn;
         
         sendPacketOnGate(syn);
         EV_INFO << "PC" << addr << " sent TCP SYN to DNS server " << dnsAddr << "\n";
@@ -241,17 +496,20 @@ class PC : public cSimpleModule {
     void sendDNSQueryUDP() {
         // Send DNS query via UDP (low latency)
         auto* query = mk("DNS_QUERY", DNS_QUERY, addr, dnsAddr);
-        query->addPar("qname").setStringValue(qname.c_str());
+        pool.addPar(query, "qname").setStringValue(qname.c_str());
         query->par("priority").setLongValue(PRIORITY_HIGH);
-        query->addPar("protocol").setStringValue("UDP");
+        pool.addPar(query, "protocol").setStringValue("UDP");
         
         // Encrypt if key is available
-        if (sharedKeys.find(dnsAddr) != sharedKeys.end()) {
-            string encrypted = simpleEncrypt(qname, sharedKeys[dnsAddr]);
+        PeerState* peer = peers.find(dnsAddr);
+        if (peer && peer->hasKey()) {
+            string encrypted = simpleEncrypt(qname, peer->key);
+            cryptoCost.chargeCipher(payloadBytes(query));
             query->par("qname").setStringValue(encrypted.c_str());
-            query->addPar("encrypted").setBoolValue(true);
+            pool.addPar(query, "encrypted").setBoolValue(true);
         }
         
+        attachEarlyData(query, dnsAddr, [this]() { sendDNSQueryUDP(); });
         sendPacketOnGate(query);
         EV_INFO << "PC" << addr << " sent UDP DNS query for " << qname << "\n";
     }
@@ -260,20 +518,21 @@ class PC : public cSimpleModule {
         long peerAddr = SRC(msg);
         long seq = SEQ(msg);
         
-        auto it = tcpConnections.find(peerAddr);
-        if (it != tcpConnections.end() && it->second.state == TCP_SYN_SENT) {
+        PeerState* peer = peers.find(peerAddr);
+        if (peer && peer->tcp.state == TCP_SYN_SENT) {
+            TCPConnection& conn = peer->tcp;
             // Validate SYN cookie
             long cookie = msg->par("synCookie").longValue();
             if (validateSYNCookie(cookie, peerAddr, addr, seq)) {
                 // Complete three-way handshake
                 auto* ack = mk("TCP_ACK", TCP_ACK, addr, peerAddr);
-                ack->par("seq").setLongValue(it->second.sendSeq);
+                ack->par("seq").setLongValue(conn.sendSeq);
                 ack->par("ack").setLongValue(seq + 1);
                 ack->par("priority").setLongValue(PRIORITY_HIGH);
                 sendPacketOnGate(ack);
                 
-                it->second.state = TCP_ESTABLISHED;
-                it->second.recvSeq = seq + 1;
+                conn.state = TCP_ESTABLISHED;
+                conn.recvSeq = seq + 1;
                 EV_INFO << "PC" << addr << " TCP connection established with " << peerAddr << "\n";
                 
                 // Determine if this is DNS or HTTP connection and send appropriate data
@@ -291,60 +550,72 @@ class PC : public cSimpleModule {
                 EV_WARN << "PC" << addr << " invalid SYN cookie from " << peerAddr << "\n";
             }
         }
-        delete msg;
+        pool.release(msg);
     }
     
     void sendHTTPDataTCP(long httpAddr) {
+        PeerState& peer = peers.get(httpAddr);
         auto* get = mk("HTTP_GET", TCP_DATA, addr, httpAddr);
-        get->addPar("path").setStringValue("/");
-        get->par("seq").setLongValue(tcpConnections[httpAddr].sendSeq);
+        pool.addPar(get, "path").setStringValue("/");
+        get->par("seq").setLongValue(peer.tcp.sendSeq);
         get->par("priority").setLongValue(PRIORITY_NORMAL);
         
         // Encrypt if key available
-        if (sharedKeys.find(httpAddr) != sharedKeys.end()) {
-            string encrypted = simpleEncrypt("/", sharedKeys[httpAddr]);
+        if (peer.hasKey()) {
+            string encrypted = simpleEncrypt("/", peer.key);
+            cryptoCost.chargeCipher(payloadBytes(get));
             get->par("path").setStringValue(encrypted.c_str());
-            get->addPar("encrypted").setBoolValue(true);
+            pool.addPar(get, "encrypted").setBoolValue(true);
         }
         
+        attachEarlyData(get, httpAddr, [this, httpAddr]() { sendHTTPDataTCP(httpAddr); });
+        acks.piggyback(get, pool);
         sendPacketOnGate(get);
-        tcpConnections[httpAddr].sendSeq++;
+        peer.tcp.sendSeq++;
         EV_INFO << "PC" << addr << " sent TCP HTTP GET request\n";
     }
     
     void sendDNSDataTCP(long peerAddr) {
+        PeerState& peer = peers.get(peerAddr);
         auto* data = mk("DNS_QUERY", TCP_DATA, addr, peerAddr);
-        data->addPar("qname").setStringValue(qname.c_str());
-        data->par("seq").setLongValue(tcpConnections[peerAddr].sendSeq);
+        pool.addPar(data, "qname").setStringValue(qname.c_str());
+        data->par("seq").setLongValue(peer.tcp.sendSeq);
         data->par("priority").setLongValue(PRIORITY_NORMAL);
         
         // Encrypt if key available
-        if (sharedKeys.find(peerAddr) != sharedKeys.end()) {
-            string encrypted = simpleEncrypt(qname, sharedKeys[peerAddr]);
+        if (peer.hasKey()) {
+            string encrypted = simpleEncrypt(qname, peer.key);
+            cryptoCost.chargeCipher(payloadBytes(data));
             data->par("qname").setStringValue(encrypted.c_str());
-            data->addPar("encrypted").setBoolValue(true);
+            pool.addPar(data, "encrypted").setBoolValue(true);
         }
         
+        attachEarlyData(data, peerAddr, [this, peerAddr]() { sendDNSDataTCP(peerAddr); });
+        acks.piggyback(data, pool);
         sendPacketOnGate(data);
-        tcpConnections[peerAddr].sendSeq++;
+        peer.tcp.sendSeq++;
         EV_INFO << "PC" << addr << " sent TCP DNS query\n";
     }
     
     void sendDBQueryTCP(long dbAddr) {
+        PeerState& peer = peers.get(dbAddr);
         auto* query = mk("DB_QUERY", TCP_DATA, addr, dbAddr);
-        query->addPar("query").setStringValue("SELECT * FROM users");
-        query->par("seq").setLongValue(tcpConnections[dbAddr].sendSeq);
+        pool.addPar(query, "query").setStringValue("SELECT * FROM users");
+        query->par("seq").setLongValue(peer.tcp.sendSeq);
         query->par("priority").setLongValue(PRIORITY_NORMAL);
         
         // Encrypt if key available
-        if (sharedKeys.find(dbAddr) != sharedKeys.end()) {
-            string encrypted = simpleEncrypt("SELECT * FROM users", sharedKeys[dbAddr]);
+        if (peer.hasKey()) {
+            string encrypted = simpleEncrypt("SELECT * FROM users", peer.key);
+            cryptoCost.chargeCipher(payloadBytes(query));
             query->par("query").setStringValue(encrypted.c_str());
-            query->addPar("encrypted").setBoolValue(true);
+            pool.addPar(query, "encrypted").setBoolValue(true);
         }
         
+        attachEarlyData(query, dbAddr, [this, dbAddr]() { sendDBQueryTCP(dbAddr); });
+        acks.piggyback(query, pool);
         sendPacketOnGate(query);
-        tcpConnections[dbAddr].sendSeq++;
+        peer.tcp.sendSeq++;
         EV_INFO << "PC" << addr << " sent TCP DB query\n";
     }
     
@@ -358,10 +629,40 @@ class PC : public cSimpleModule {
         
         dupAckCount = 0;
         EV_INFO << "PC" << addr << " received ACK, cwnd=" << cwnd << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
-    void handleTCPData(cMessage* msg) {
+    // One application delivery for a coalesced run of data segments; msg is
+    // the newest of them. Only the last segment of an offloaded send reaches
+    // the handlers, while video chunks all count for the player.
+    void deliverData(cMessage* msg, int segments) {
+        int kind = msg->getKind();
+        if (ceMarked(msg)) {
+            ceReceived[SRC(msg)] += segments;
+            ceMarksReceived += segments;
+        }
+        if (kind == VIDEO_CHUNK) {
+            handleVideoChunk(msg, segments);
+        } else if (!isLastSegment(msg)) {
+            segmentsReceived += segments;
+            if (kind == TCP_DATA) {
+                auto* ack = mk("TCP_ACK", TCP_ACK, addr, SRC(msg));
+                ack->par("ack").setLongValue(SEQ(msg) + 1);
+                ack->par("priority").setLongValue(PRIORITY_HIGH);
+                echoEcn(ack, msg);
+                queueAck(ack, segments);
+            }
+            pool.release(msg);
+        } else if (kind == TCP_DATA) {
+            segmentsReceived += segments - 1;
+            handleTCPData(msg, segments);
+        } else {
+            segmentsReceived += segments - 1;
+            handlePacket(msg);
+        }
+    }
+    
+    void handleTCPData(cMessage* msg, int segments = 1) {
         // Receive data, send ACK
         long peerAddr = SRC(msg);
         long seq = SEQ(msg);
@@ -376,16 +677,19 @@ class PC : public cSimpleModule {
                 EV_INFO << " (encrypted)";
                 
                 // Decrypt if we have the key
-                if (msg->hasPar("encData") && sharedKeys.find(peerAddr) != sharedKeys.end()) {
-                    string encData = msg->par("encData").stringValue();
-                    string decrypted = simpleDecrypt(encData, sharedKeys[peerAddr]);
+                PeerState* peer = peers.find(peerAddr);
+                if (msg->hasPar("encData") && peer && peer->hasKey()) {
+                    string decrypted = simpleDecrypt(getPayload(msg, "encData"), peer->key);
+                    cryptoCost.chargeCipher(payloadBytes(msg));
                     EV_INFO << ", decrypted";
                 }
             }
             EV_INFO << "\n";
+            recordHttpLatency();
             
             // After receiving HTTP response, initiate DB query
-            if (tcpConnections.find(601) == tcpConnections.end()) {
+            PeerState* db = peers.find(601);
+            if (!db || !db->hasConnection()) {
                 // Start TCP connection to DB server
                 sendDBRequestTCP(601);
             }
@@ -396,10 +700,32 @@ class PC : public cSimpleModule {
         auto* ack = mk("TCP_ACK", TCP_ACK, addr, peerAddr);
         ack->par("ack").setLongValue(seq + 1);
         ack->par("priority").setLongValue(PRIORITY_HIGH);
-        sendPacketOnGate(ack);
+        echoEcn(ack, msg);
+        queueAck(ack, segments);
         
-        EV_INFO << "PC" << addr << " sent ACK for TCP data\n";
-        delete msg;
+        EV_INFO << "PC" << addr << " acknowledged TCP data\n";
+        pool.release(msg);
+    }
+    
+    // ACKs to an ECN-capable sender carry its CE count so far
+    void echoEcn(cMessage* ack, cMessage* data) {
+        if (data->hasPar("ecn")) pool.addPar(ack, "ecnEcho").setLongValue(ceReceived[SRC(data)]);
+    }
+    
+    // ACK for received data segments, subject to delayed ACKs
+    void queueAck(cMessage* ack, int segments = 1) {
+        acks.submit(ack, pool, [&](cMessage* due) { sendAck(due); }, segments);
+        if (acks.hasPending() && !delayedAckTimer->isScheduled()) {
+            scheduleAt(simTime() + acks.timeout, delayedAckTimer);
+        }
+    }
+    
+    void sendAck(cMessage* ack) {
+        if (acks.coalesceQueued(txQueue, ack)) {
+            pool.release(ack);
+        } else {
+            sendPacketOnGate(ack);
+        }
     }
     
     void handleTCPFin(cMessage* msg) {
@@ -410,25 +736,27 @@ class PC : public cSimpleModule {
         finAck->par("priority").setLongValue(PRIORITY_NORMAL);
         sendPacketOnGate(finAck);
         
-        tcpConnections[peerAddr].state = TCP_CLOSED;
+        if (PeerState* peer = peers.find(peerAddr)) peer->tcp.state = TCP_CLOSED;
         EV_INFO << "PC" << addr << " closed TCP connection with " << peerAddr << "\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleUDPData(cMessage* msg) {
         EV_INFO << "PC" << addr << " received UDP data\n";
-        delete msg;
+        pool.release(msg);
     }
     
     void handleEncryptedData(cMessage* msg) {
         long peerAddr = SRC(msg);
-        string encData = msg->par("encData").stringValue();
+        const string& encData = getPayload(msg, "encData");
         
-        if (sharedKeys.find(peerAddr) != sharedKeys.end()) {
-            string decrypted = simpleDecrypt(encData, sharedKeys[peerAddr]);
+        PeerState* peer = peers.find(peerAddr);
+        if (peer && peer->hasKey()) {
+            string decrypted = simpleDecrypt(encData, peer->key);
+            cryptoCost.chargeCipher(payloadBytes(msg));
             EV_INFO << "PC" << addr << " decrypted data from " << peerAddr << "\n";
         }
-        delete msg;
+        pool.release(msg);
     }
     
     void handleDNSResponse(cMessage* msg) {
@@ -436,11 +764,18 @@ class PC : public cSimpleModule {
         bool isEncrypted = msg->hasPar("encrypted") && msg->par("encrypted").boolValue();
         
         string qnameResult = msg->par("qname").stringValue();
-        if (isEncrypted && sharedKeys.find(SRC(msg)) != sharedKeys.end()) {
-            qnameResult = simpleDecrypt(qnameResult, sharedKeys[SRC(msg)]);
+        PeerState* peer = peers.find(SRC(msg));
+        if (isEncrypted && peer && peer->hasKey()) {
+            qnameResult = simpleDecrypt(qnameResult, peer->key);
+            cryptoCost.chargeCipher(payloadBytes(msg));
         }
         
         EV_INFO << "PC" << addr << " DNS: " << qnameResult << " -> " << httpAddr << "\n";
+        if (dnsSentAt >= 0) {
+            dnsLatency.add(simTime() - dnsSentAt);
+            dnsLatencyVector.record(simTime() - dnsSentAt);
+            dnsSentAt = -1;
+        }
         
         // Initiate key exchange with HTTP server
         initiateKeyExchange(httpAddr);
@@ -449,13 +784,14 @@ class PC : public cSimpleModule {
         initiateKeyExchange(601);
         
         // Send HTTP request (choose protocol based on traffic type)
+        httpSentAt = simTime();
         if (protocol == "UDP") {
             sendHTTPRequestUDP(httpAddr);
         } else {
             sendHTTPRequestTCP(httpAddr);
         }
         
-        delete msg;
+        pool.release(msg);
     }
     
     void sendHTTPRequestTCP(long httpAddr) {
@@ -465,14 +801,14 @@ class PC : public cSimpleModule {
         auto* syn = mk("TCP_SYN", TCP_SYN, addr, httpAddr);
         syn->par("seq").setLongValue(seq);
         syn->par("priority").setLongValue(PRIORITY_NORMAL);
-        syn->addPar("synCookie").setLongValue(generateSYNCookie(addr, httpAddr, seq));
+        pool.addPar(syn, "synCookie").setLongValue(generateSYNCookie(addr, httpAddr, seq));
         
         TCPConnection conn;
         conn.remoteAddr = httpAddr;
         conn.state = TCP_SYN_SENT;
         conn.sendSeq = seq + 1;
         conn.lastSent = simTime();
-        tcpConnections[httpAddr] = conn;
+        peers.get(httpAddr).tcp = conn;
         
         sendPacketOnGate(syn);
         EV_INFO << "PC" << addr << " initiating TCP connection to HTTP server\n";
@@ -485,14 +821,14 @@ class PC : public cSimpleModule {
         auto* syn = mk("TCP_SYN", TCP_SYN, addr, dbAddr);
         syn->par("seq").setLongValue(seq);
         syn->par("priority").setLongValue(PRIORITY_NORMAL);
-        syn->addPar("synCookie").setLongValue(generateSYNCookie(addr, dbAddr, seq));
+        pool.addPar(syn, "synCookie").setLongValue(generateSYNCookie(addr, dbAddr, seq));
         
         TCPConnection conn;
         conn.remoteAddr = dbAddr;
         conn.state = TCP_SYN_SENT;
         conn.sendSeq = seq + 1;
         conn.lastSent = simTime();
-        tcpConnections[dbAddr] = conn;
+        peers.get(dbAddr).tcp = conn;
         
         sendPacketOnGate(syn);
         EV_INFO << "PC" << addr << " initiating TCP connection to DB server\n";
@@ -500,16 +836,19 @@ class PC : public cSimpleModule {
     
     void sendHTTPRequestUDP(long httpAddr) {
         auto* get = mk("HTTP_GET", UDP_DATA, addr, httpAddr);
-        get->addPar("path").setStringValue("/");
+        pool.addPar(get, "path").setStringValue("/");
         get->par("priority").setLongValue(PRIORITY_NORMAL);
         
         // Encrypt if key available
-        if (sharedKeys.find(httpAddr) != sharedKeys.end()) {
-            string encrypted = simpleEncrypt("/", sharedKeys[httpAddr]);
+        PeerState* peer = peers.find(httpAddr);
+        if (peer && peer->hasKey()) {
+            string encrypted = simpleEncrypt("/", peer->key);
+            cryptoCost.chargeCipher(payloadBytes(get));
             get->par("path").setStringValue(encrypted.c_str());
-            get->addPar("encrypted").setBoolValue(true);
+            pool.addPar(get, "encrypted").setBoolValue(true);
         }
         
+        attachEarlyData(get, httpAddr, [this, httpAddr]() { sendHTTPRequestUDP(httpAddr); });
         sendPacketOnGate(get);
         EV_INFO << "PC" << addr << " sent UDP HTTP GET request\n";
     }
@@ -523,8 +862,17 @@ class PC : public cSimpleModule {
             EV_INFO << " (encrypted)";
         }
         EV_INFO << "\n";
+        recordHttpLatency();
         
-        delete msg;
+        pool.release(msg);
+    }
+    
+    // First response bytes for the outstanding HTTP request
+    void recordHttpLatency() {
+        if (httpSentAt < 0) return;
+        httpLatency.add(simTime() - httpSentAt);
+        httpLatencyVector.record(simTime() - httpSentAt);
+        httpSentAt = -1;
     }
     
     void handleDBResponse(cMessage* msg) {
@@ -533,8 +881,10 @@ class PC : public cSimpleModule {
         string result = msg->par("result").stringValue();
         
         // Decrypt if encrypted
-        if (isEncrypted && sharedKeys.find(SRC(msg)) != sharedKeys.end()) {
-            result = simpleDecrypt(result, sharedKeys[SRC(msg)]);
+        PeerState* peer = peers.find(SRC(msg));
+        if (isEncrypted && peer && peer->hasKey()) {
+            result = simpleDecrypt(result, peer->key);
+            cryptoCost.chargeCipher(payloadBytes(msg));
         }
         
         EV_INFO << "PC" << addr << " received DB response: " << bytes << " bytes";
@@ -543,17 +893,199 @@ class PC : public cSimpleModule {
         }
         EV_INFO << ", Result: " << result << "\n";
         
-        delete msg;
+        pool.release(msg);
+    }
+    
+    // ==================== VIDEO STREAMING ====================
+    
+    void startVideoSession() {
+        // A repeat restarts playback from the first segment
+        cancelEvent(videoRequestEvt);
+        cancelEvent(videoStallEvt);
+        cancelEvent(videoTimeoutEvt);
+        drainBuffer();
+        if (stalled) {
+            rebufferTime += (simTime() - stallStart).dbl();
+        }
+        
+        sessionStart = simTime();
+        nextSegment = 0;
+        videoQuality = -1;
+        playedQuality = -1;
+        bufferLevel = 0;
+        bufferUpdated = simTime();
+        playing = false;
+        stalled = false;
+        videoSessions++;
+        
+        EV_INFO << "PC" << addr << " starting video session with " << videoServerAddr
+                << " (" << abr.algorithm << ")\n";
+        requestSegment();
+    }
+    
+    // Plays out the buffer up to now
+    void drainBuffer() {
+        if (playing && !stalled) {
+            double played = min((simTime() - bufferUpdated).dbl(), bufferLevel);
+            bufferLevel -= played;
+            playedTime += played;
+        }
+        bufferUpdated = simTime();
+    }
+    
+    void requestSegment() {
+        drainBuffer();
+        videoQuality = abr.choose(bufferLevel, playedQuality);
+        double bitrate = abr.bitrates[videoQuality];
+        segmentBytes = (long)(bitrate * 1000 * abr.segmentDuration / 8);
+        segmentChunks = 0;
+        chunksReceived = 0;
+        nextChunk = 0;
+        chunkSeen.clear();
+        videoRequest++;
+        segmentRequested = simTime();
+        
+        auto* request = mk("VIDEO_REQUEST", VIDEO_REQUEST, addr, videoServerAddr);
+        pool.addPar(request, "segment").setLongValue(nextSegment);
+        pool.addPar(request, "request").setLongValue(videoRequest);
+        pool.addPar(request, "bytes").setLongValue(segmentBytes);
+        pool.addPar(request, "protocol").setStringValue(protocol == "UDP" ? "UDP" : "TCP");
+        request->par("priority").setLongValue(PRIORITY_NORMAL);
+        request->setByteLength(200);
+        sendPacketOnGate(request);
+        
+        cancelEvent(videoTimeoutEvt);
+        scheduleAt(simTime() + segmentTimeout, videoTimeoutEvt);
+        EV_INFO << "PC" << addr << " requested segment " << nextSegment << " at " << bitrate
+                << " kbps, buffer " << bufferLevel << "s\n";
+    }
+    
+    // A coalesced run of chunks ends at the chunk msg carries, so it covers
+    // chunks SEQ(msg) - chunks + 1 .. SEQ(msg)
+    void handleVideoChunk(cMessage* msg, int chunks = 1) {
+        if (msg->par("segment").longValue() != nextSegment || !msg->hasPar("request") ||
+            msg->par("request").longValue() != videoRequest || !videoTimeoutEvt->isScheduled()) {
+            pool.release(msg);  // Late chunk of an abandoned request or an earlier attempt
+            return;
+        }
+        segmentChunks = msg->par("chunks").longValue();
+        chunkSeen.resize(segmentChunks, false);
+        long first = SEQ(msg) - chunks + 1;
+        bool inOrder = first == nextChunk;
+        for (long i = max(0L, first); i <= SEQ(msg) && i < segmentChunks; i++) {
+            if (!chunkSeen[i]) {
+                chunkSeen[i] = true;
+                chunksReceived++;
+            }
+        }
+        while (nextChunk < segmentChunks && chunkSeen[nextChunk]) nextChunk++;
+        
+        // TCP mode: cumulative ACK of the next chunk expected clocks the
+        // server's window. Out-of-order and duplicate chunks are ACKed at
+        // once (RFC 5681 section 4.2) so the server sees duplicate ACKs.
+        if (protocol != "UDP") {
+            auto* ack = mk("VIDEO_ACK", TCP_ACK, addr, videoServerAddr);
+            ack->par("ack").setLongValue(nextChunk);
+            pool.addPar(ack, "segment").setLongValue(nextSegment);
+            pool.addPar(ack, "request").setLongValue(videoRequest);
+            ack->par("priority").setLongValue(PRIORITY_HIGH);
+            ack->setByteLength(40);
+            echoEcn(ack, msg);
+            if (inOrder) {
+                queueAck(ack, chunks);
+            } else {
+                // Not folded into a queued ACK either: each duplicate counts
+                acks.sendNow(ack, pool, [&](cMessage* due) { sendPacketOnGate(due); });
+            }
+        }
+        
+        if (nextChunk >= segmentChunks) {
+            segmentComplete();
+        }
+        pool.release(msg);
+    }
+    
+    void segmentComplete() {
+        cancelEvent(videoTimeoutEvt);
+        drainBuffer();
+        
+        double seconds = max((simTime() - segmentRequested).dbl(), 1e-6);
+        double kbps = segmentBytes * 8 / 1000.0 / seconds;
+        abr.addSample(kbps);
+        throughputVector.record(kbps);
+        
+        double bitrate = abr.bitrates[videoQuality];
+        bitrateVector.record(bitrate);
+        bitrateTotal += bitrate;
+        segmentsDownloaded++;
+        if (playedQuality >= 0 && videoQuality != playedQuality) bitrateSwitches++;
+        playedQuality = videoQuality;
+        
+        bufferLevel += abr.segmentDuration;
+        nextSegment++;
+        if (stalled) {
+            rebufferTime += (simTime() - stallStart).dbl();
+            stalled = false;
+            EV_INFO << "PC" << addr << " playback resumed after " << simTime() - stallStart << "s stall\n";
+        }
+        if (!playing && (bufferLevel >= startupBuffer || nextSegment >= videoSegments)) {
+            playing = true;
+            double delay = (simTime() - sessionStart).dbl();
+            startupDelayTotal += delay;
+            startups++;
+            startupDelayVector.record(delay);
+            EV_INFO << "PC" << addr << " playback started after " << delay << "s\n";
+        }
+        bufferVector.record(bufferLevel);
+        
+        if (playing) {
+            cancelEvent(videoStallEvt);
+            scheduleAt(simTime() + bufferLevel, videoStallEvt);
+        }
+        
+        // Keep the buffer below maxBuffer: wait until the next segment fits
+        if (nextSegment < videoSegments) {
+            double wait = bufferLevel + abr.segmentDuration - abr.maxBuffer;
+            if (wait <= 0) {
+                requestSegment();
+            } else {
+                scheduleAt(simTime() + wait, videoRequestEvt);
+            }
+        }
+    }
+    
+    void handleBufferEmpty() {
+        drainBuffer();
+        bufferLevel = 0;
+        bufferVector.record(0);
+        if (nextSegment >= videoSegments) {
+            playing = false;  // Played to the end
+            EV_INFO << "PC" << addr << " video session finished\n";
+            return;
+        }
+        stalled = true;
+        stallStart = simTime();
+        rebufferCount++;
+        EV_WARN << "PC" << addr << " rebuffering at segment " << nextSegment << "\n";
+    }
+    
+    void handleSegmentTimeout() {
+        // Count what arrived as the throughput sample so the ABR backs off, then retry
+        segmentTimeouts++;
+        long chunkBytes = segmentChunks > 0 ? segmentBytes / segmentChunks : 0;
+        abr.addSample(max(1.0, chunksReceived * chunkBytes * 8 / 1000.0 / segmentTimeout));
+        EV_WARN << "PC" << addr << " segment " << nextSegment << " timed out, retrying\n";
+        requestSegment();
     }
     
     void handleRetransmit() {
         // Retransmit unacknowledged packets
-        for (auto& conn : tcpConnections) {
-            if (conn.second.state == TCP_SYN_SENT) {
-                EV_WARN << "PC" << addr << " retransmitting SYN to " << conn.first << "\n";
+        peers.forEach([&](PeerState& peer) {
+            if (peer.tcp.state == TCP_SYN_SENT) {
+                EV_WARN << "PC" << addr << " retransmitting SYN to " << peer.addr << "\n";
                 // Retransmit logic here
             }
-        }
+        });
     }
     
     void handleCongestionTimeout() {
@@ -566,13 +1098,51 @@ class PC : public cSimpleModule {
 
     void finish() override {
         cancelAndDelete(startEvt);
+        
+        recordScalar("fullHandshakes", fullHandshakes);
+        recordScalar("resumedHandshakes", resumedHandshakes);
+        recordScalar("earlyDataResent", earlyDataResent);
+        recordScalar("networkErrors", networkErrors);
+        recordScalar("segmentsReceived", segmentsReceived);
+        recordScalar("ceMarksReceived", ceMarksReceived);
+        dnsLatency.recordScalars(this, "dnsLatency");
+        httpLatency.recordScalars(this, "httpLatency");
+        cryptoCost.recordScalars(this);
+        cancelAndDelete(cryptoTimer);
+        cryptoCost.clear();
+        pool.recordScalars(this);
         cancelAndDelete(retransmitTimer);
         cancelAndDelete(congestionTimer);
+        cancelAndDelete(delayedAckTimer);
+        acks.recordScalars(this);
+        acks.clear();
+        cancelAndDelete(groTimer);
+        cancelAndDelete(reassemblyTimer);
+        gro.recordScalars(this);
+        gro.clear();
+        reassembly.recordScalars(this);
+        reassembly.clear();
         
-        // Clean up transmission queue
-        if (endTxEvent != nullptr) {
-            cancelAndDelete(endTxEvent);
+        if (videoSessions > 0) {
+            drainBuffer();
+            if (stalled) rebufferTime += (simTime() - stallStart).dbl();
+            recordScalar("videoSessions", videoSessions);
+            recordScalar("videoStartupDelay", startups ? startupDelayTotal / startups : -1);
+            recordScalar("videoRebufferCount", rebufferCount);
+            recordScalar("videoRebufferTime", rebufferTime);
+            recordScalar("videoRebufferRatio", rebufferTime + playedTime > 0 ?
+                         rebufferTime / (rebufferTime + playedTime) : 0);
+            recordScalar("videoAvgBitrate", segmentsDownloaded ? bitrateTotal / segmentsDownloaded : 0);
+            recordScalar("videoBitrateSwitches", bitrateSwitches);
+            recordScalar("videoSegments", segmentsDownloaded);
+            recordScalar("videoSegmentTimeouts", segmentTimeouts);
         }
+        cancelAndDelete(videoRequestEvt);
+        cancelAndDelete(videoStallEvt);
+        cancelAndDelete(videoTimeoutEvt);
+        
+        // Clean up transmission queue
+        cancelAndDelete(endTxEvent);
         while (!txQueue.isEmpty()) {
             delete txQueue.pop();
         }
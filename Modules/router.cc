@@ -1,25 +1,86 @@
 #include <omnetpp.h>
 #include "helpers.h"
 #include <map>
+#include <set>
 #include <vector>
 #include <sstream>
+#include <atomic>
+#include <chrono>
+#include <thread>
 using namespace omnetpp;
 using namespace std;
 
+// ORACLE routing: shortest-path FIBs for every router, computed once per
+// network by the first router to reach init stage 1 and shared by the rest
+struct OracleRoutes {
+    map<cModule*, map<long, pair<int, int>>> fib;  // router -> dest -> (gate, hops)
+    int users = 0;                                  // Routers still holding a FIB
+};
+static OracleRoutes oracleRoutes;
+
 class Router : public cSimpleModule {
   private:
     map<long, RouteEntry> routingTable;    // Destination -> RouteEntry
     map<long, LinkState> linkStateDB;      // OSPF link state database
+    set<long> ospfInstalled;               // routingTable entries owned by OSPF
     map<long, map<long, double>> ripTable; // RIP: dest -> (nextHop -> metric)
     
     long routerId;
-    string routingProtocol;  // "OSPF-TE" or "RIP" or "STATIC"
+    vector<long> neighborAddr;  // gate -> address at the far end, -1 if none
+    vector<bool> neighborIsRouter;
+    string routingProtocol;  // "OSPF-TE", "RIP", "STATIC" or "ORACLE"
     
     // OSPF parameters
     double ospfHelloInterval;
     double ospfLSAInterval;
+    double ospfLSAMaxAge;    // LSDB entries not refreshed this long are purged
     cMessage* ospfHelloTimer;
     cMessage* ospfLSATimer;
+    double ospfSPFDelay;
+    cMessage* ospfSPFTimer;  // Pending SPF run after LSDB changes
+    long ospfLSASeq = 0;
+    
+    // OSPF adjacencies to neighboring routers, kept alive by Hellos. They
+    // start up; a gate silent for ospfDeadInterval goes down and leaves SPF
+    double ospfDeadInterval;
+    vector<simtime_t> lastHello;
+    vector<bool> adjacencyUp;
+    vector<simtime_t> adjacencyDownSince;
+    long adjacencyDowns = 0;
+    simtime_t adjacencyDownTime;
+    simtime_t maxHelloDelay;
+    cOutVector helloDelayVector;
+    
+    // Control plane protection: routing messages are punted to a route
+    // processor that handles controlPlaneRate of them per second, Hellos
+    // first, and leave ahead of queued data on every gate
+    bool controlPlaneProtection;
+    double controlPlaneRate;
+    int controlQueueLimit;
+    deque<cMessage*> puntQueue[2];   // [0] Hellos, [1] other routing messages
+    simtime_t puntFree;              // Route processor busy until then
+    cMessage* puntTimer = nullptr;
+    map<int, deque<cMessage*>> controlTxQueue;  // per-gate, served before txQueue
+    long puntedPackets = 0;
+    long puntDrops = 0;
+    
+    // BFD: a session on every link to another router, all driven by one
+    // bfdTimer tick. A session that hears nothing for bfdMultiplier
+    // intervals goes down and takes the OSPF adjacency and BGP session on
+    // that gate down with it at once.
+    enum { BFD_DOWN, BFD_INIT, BFD_UP };
+    bool bfd;
+    double bfdInterval;
+    int bfdMultiplier;
+    vector<int> bfdState;
+    vector<simtime_t> bfdLastRx;
+    cMessage* bfdTimer = nullptr;
+    long bfdSessionDowns = 0;
+    
+    // Link failure injection: failGate goes down in both directions at failAt
+    int failGate;
+    cMessage* linkFailTimer = nullptr;
+    long linkFailureDrops = 0;           // Packets sent into a failed link
     
     // RIP parameters
     double ripUpdateInterval;
@@ -34,19 +95,116 @@ class Router : public cSimpleModule {
     double synRateLimit;
     cMessage* rateLimitResetTimer;
     
+    // Packets without a route: error back to the source, or a flood bounded
+    // to floodTTL hops when noRouteFlood is set
+    bool noRouteFlood;
+    int floodTTL;
+    double errorRateLimit;               // Errors sent per second
+    int errorsThisSecond = 0;
+    long errorsSent = 0;
+    long ttlDrops = 0;
+    long floodedPackets = 0;
+    
+    // Fragmentation to the MTU of the next link
+    vector<int> gateMtu;                 // gate -> MTU of its channel
+    long nextFragId = 0;
+    long packetsFragmented = 0;
+    long fragmentsSent = 0;
+    long tooBigDrops = 0;                // Don't Fragment packets that did not fit
+    
     // Priority queue for congestion management
     vector<priority_queue<cMessage*, vector<cMessage*>, MessagePriorityCompare>> outputQueues;
     
     // Transmission queue management
-    map<int, cQueue> txQueue;  // per-gate transmission queues
+    map<int, EgressQueue> txQueue;  // per-gate transmission queues (FIFO or FQ-CoDel)
+    SharedBuffer buffer;             // Packet memory behind all txQueues
     map<int, cMessage*> endTxEvent;  // per-gate end of transmission events
     
+    // ECN: ECN-capable packets are marked CE when they join an egress queue
+    // of ecnThreshold packets or more (DCTCP's instantaneous-queue marking)
+    int ecnThreshold;
+    long ecnMarked = 0;
+    long queuedPackets = 0;
+    simtime_t queueDelayTotal;
+    int maxQueueLength = 0;
+    cOutVector queueDelayVector;
+    
+    // DiffServ edge: arriving traffic is classified by kind and policed per
+    // class, out-of-profile packets drop a class; each egress gate is paced
+    // to shapeRate by a calendar queue, which CRITICAL traffic bypasses
+    bool diffserv;
+    TokenBucket policers[PRIORITY_CRITICAL + 1];
+    long classified[PRIORITY_CRITICAL + 1] = {};
+    long remarked[PRIORITY_CRITICAL + 1] = {};
+    double shapeRate;                // bits/s, 0 = no shaper
+    CalendarQueue shaper;
+    map<int, simtime_t> shapeNext;   // per-gate time the shaped link is free again
+    cMessage* shaperTimer = nullptr;
+    long shaperDelayed = 0;
+    long shaperDrops = 0;
+    PacketPool pool;                 // Recycled packets, see mk() and pool.release()
+    
+    // BGP speaker, enabled when asNumber > 0
+    struct BGPPeer {
+        int gate = -1;
+        long routerId = 0;
+        long remoteAS = 0;
+        bool established = false;
+        simtime_t lastHeard;
+        map<long, BGPRoute> adjRibIn;    // prefix -> route received on this session
+        map<long, string> adjRibOut;     // prefix -> attributes last announced
+        set<long> pending;               // Prefixes to re-export at the next flush
+        cMessage* mraiTimer = nullptr;   // Running while further updates are held back
+        
+        bool ibgp(long localAS) const { return remoteAS == localAS; }
+    };
+    long asNumber;
+    map<int, BGPPeer> bgpPeers;          // gate -> session
+    map<long, BGPRoute> bgpOriginated;   // Prefixes this router injects
+    map<long, BGPRoute> locRib;          // prefix -> selected best route
+    set<long> bgpInstalled;              // routingTable entries owned by BGP
+    bool bgpRouteReflector;
+    long bgpLocalPref;
+    double bgpMRAI;
+    double bgpIbgpMRAI;
+    double bgpKeepaliveInterval;
+    double bgpHoldTime;
+    cMessage* bgpKeepaliveTimer;
+    
+    // Churn and convergence statistics
+    long bgpUpdatesSent = 0;
+    long bgpUpdatesReceived = 0;
+    long bgpPrefixesAnnounced = 0;
+    long bgpPrefixesWithdrawn = 0;
+    long bgpBestPathChanges = 0;
+    long noRouteDrops = 0;
+    simtime_t bgpLastChange;
+    cOutVector bgpRibVector;
+    
   protected:
-    void initialize() override {
+    // Pooled packet factory; shadows the global mk() inside this module
+    cPacket* mk(const char* name, int kind, long src, long dst) {
+        return pool.get(name, kind, src, dst);
+    }
+    
+    int numInitStages() const override { return 2; }
+    
+    void initialize(int stage) override {
+        if (stage == 0) {
+            initializeLocal();
+        } else if (stage == 1 && routingProtocol == "ORACLE") {
+            // Every module has its address by now
+            installOracleRoutes();
+        }
+    }
+    
+    void initializeLocal() {
+        ospfHelloTimer = ospfLSATimer = ospfSPFTimer = ripUpdateTimer = bgpKeepaliveTimer = nullptr;
         routerId = par("address");
         routingProtocol = par("routingProtocol").stdstringValue();
         
-        // Initialize static routes if provided
+        // Static routes, for destinations that are neither adjacent nor
+        // learned by a routing protocol
         const char* s = par("routes").stringValue();
         stringstream ss(s ? s : "");
         string item;
@@ -70,22 +228,74 @@ class Router : public cSimpleModule {
             linkBandwidth[i] = 100.0;  // 100 Mbps default
             linkUtilization[i] = 0.0;
             outputQueues.push_back(priority_queue<cMessage*, vector<cMessage*>, MessagePriorityCompare>());
-            txQueue[i].setName(("txQueue-" + to_string(i)).c_str());
-            endTxEvent[i] = nullptr;
+            txQueue[i].configure(this);
+            endTxEvent[i] = new cMessage("endTx");
+            gateMtu.push_back(channelMtu(gate("pppg$o", i)));
         }
+        discoverNeighbors();
         
         // SYN flood protection
         synRateLimit = par("synRateLimit").doubleValue();
         rateLimitResetTimer = new cMessage("rateLimitReset");
         scheduleAt(simTime() + 1.0, rateLimitResetTimer);
         
+        ecnThreshold = par("ecnThreshold");
+        buffer.configure(this);
+        queueDelayVector.setName("queueDelay");
+        
+        // Policers: "class:bits/s:burst bytes", e.g. "3:1000000:16000"
+        diffserv = par("diffserv").boolValue();
+        stringstream policerList(par("policers").stdstringValue());
+        while (getline(policerList, item, ',')) {
+            int c = -1; double rate = 0, burst = 0;
+            if (sscanf(item.c_str(), "%d:%lf:%lf", &c, &rate, &burst) == 3 &&
+                c > PRIORITY_LOW && c <= PRIORITY_CRITICAL) {
+                policers[c].rate = rate / 8;
+                policers[c].burst = policers[c].tokens = burst;
+            }
+        }
+        shapeRate = par("shapeRate").doubleValue();
+        shaper.configure(par("shapeSlot").doubleValue(), par("shapeSlots"));
+        shaperTimer = new cMessage("shaper");
+        
+        controlPlaneProtection = par("controlPlaneProtection").boolValue();
+        controlPlaneRate = par("controlPlaneRate").doubleValue();
+        controlQueueLimit = par("controlQueueLimit");
+        puntTimer = new cMessage("punt");
+        ospfDeadInterval = par("ospfDeadInterval").doubleValue();
+        lastHello.assign(gateSize("pppg"), simTime());
+        adjacencyUp.assign(gateSize("pppg"), true);
+        adjacencyDownSince.assign(gateSize("pppg"), 0);
+        helloDelayVector.setName("helloDelay");
+        
+        bfd = par("bfd").boolValue();
+        bfdInterval = par("bfdInterval").doubleValue();
+        bfdMultiplier = par("bfdMultiplier");
+        bfdState.assign(gateSize("pppg"), BFD_DOWN);
+        bfdLastRx.assign(gateSize("pppg"), 0);
+        bfdTimer = new cMessage("bfd");
+        if (bfd) scheduleAt(simTime() + uniform(0, bfdInterval), bfdTimer);
+        
+        failGate = par("failGate");
+        linkFailTimer = new cMessage("linkFail");
+        if (failGate >= 0 && failGate < gateSize("pppg")) {
+            scheduleAt(par("failAt").doubleValue(), linkFailTimer);
+        }
+        
+        noRouteFlood = par("noRouteFlood").boolValue();
+        floodTTL = par("floodTTL");
+        errorRateLimit = par("errorRateLimit").doubleValue();
+        
         // Setup routing protocol timers
         if (routingProtocol == "OSPF-TE") {
             ospfHelloInterval = par("ospfHelloInterval").doubleValue();
             ospfLSAInterval = par("ospfLSAInterval").doubleValue();
+            ospfLSAMaxAge = par("ospfLSAMaxAge").doubleValue();
+            ospfSPFDelay = par("ospfSPFDelay").doubleValue();
             
             ospfHelloTimer = new cMessage("ospfHello");
             ospfLSATimer = new cMessage("ospfLSA");
+            ospfSPFTimer = new cMessage("ospfSPF");
             
             scheduleAt(simTime() + uniform(0, 1), ospfHelloTimer);
             scheduleAt(simTime() + uniform(0, 2), ospfLSATimer);
@@ -97,9 +307,205 @@ class Router : public cSimpleModule {
             scheduleAt(simTime() + uniform(0, ripUpdateInterval), ripUpdateTimer);
             
             EV_INFO << "Router " << routerId << " initialized with RIP\n";
+        } else if (routingProtocol == "ORACLE") {
+            oracleRoutes.users++;
+        }
+        
+        asNumber = par("asNumber");
+        if (asNumber > 0) {
+            initializeBGP();
         }
     }
-
+    
+    // Directly connected routes from the wiring: the module at the far end of
+    // each pppg gate. Replaces hand-written gate indices in the routes
+    // parameter, which only needs non-adjacent destinations now.
+    void discoverNeighbors() {
+        int n = gateSize("pppg");
+        neighborAddr.assign(n, -1);
+        neighborIsRouter.assign(n, false);
+        for (int i = 0; i < n; i++) {
+            cGate* end = gate("pppg$o", i)->getPathEndGate();
+            cModule* neighbor = end->getOwnerModule();
+            if (neighbor == this || !neighbor->hasPar("address")) continue;  // Unconnected
+            
+            long addr = neighbor->par("address");
+            neighborAddr[i] = addr;
+            neighborIsRouter[i] = dynamic_cast<Router*>(neighbor) != nullptr;
+            
+            auto it = routingTable.find(addr);
+            if (it != routingTable.end() && it->second.nextHop != i) {
+                EV_WARN << "Router " << routerId << " static route " << addr << ":"
+                        << it->second.nextHop << " contradicts the wiring, using gate " << i << "\n";
+            }
+            RouteEntry re;
+            re.destAddr = addr;
+            re.nextHop = i;
+            re.metric = 1.0;
+            re.hopCount = 1;
+            re.bandwidth = linkBandwidth[i];
+            re.delay = 1.0;
+            routingTable[addr] = re;
+        }
+    }
+    
+    void installOracleRoutes() {
+        if (!oracleRoutes.fib.count(this)) {
+            computeOracleRoutes();
+        }
+        auto& fib = oracleRoutes.fib[this];
+        for (auto& entry : fib) {
+            RouteEntry re;
+            re.destAddr = entry.first;
+            re.nextHop = entry.second.first;
+            re.metric = entry.second.second;
+            re.hopCount = entry.second.second;
+            re.bandwidth = linkBandwidth[re.nextHop];
+            re.delay = 1.0;
+            routingTable[entry.first] = re;  // Overrides any static route
+        }
+        EV_INFO << "Router " << routerId << " installed " << fib.size() << " ORACLE routes\n";
+        fib.clear();
+    }
+    
+    // Hop-count shortest paths from every router to every addressed module.
+    // The graph is copied out of cTopology into flat arrays once, then one
+    // reverse BFS per destination runs on worker threads; hosts terminate
+    // paths but never relay them.
+    void computeOracleRoutes() {
+        auto start = chrono::steady_clock::now();
+        cTopology topo("oracle");
+        topo.extractByParameter("address");
+        int n = topo.getNumNodes();
+        
+        vector<long> addrs(n);
+        vector<int> routerIndex(n, -1);       // node -> column in the result
+        vector<cModule*> routers;
+        map<cModule*, int> nodeOf;
+        for (int i = 0; i < n; i++) {
+            cModule* mod = topo.getNode(i)->getModule();
+            nodeOf[mod] = i;
+            addrs[i] = mod->par("address");
+            if (dynamic_cast<Router*>(mod)) {
+                routerIndex[i] = routers.size();
+                routers.push_back(mod);
+            }
+        }
+        
+        // in[v] = (u, gate on u) for every link u -> v that a router can send on
+        vector<vector<pair<int, int>>> in(n);
+        for (int u = 0; u < n; u++) {
+            if (routerIndex[u] < 0) continue;
+            cTopology::Node* node = topo.getNode(u);
+            for (int j = 0; j < node->getNumOutLinks(); j++) {
+                cTopology::LinkOut* link = node->getLinkOut(j);
+                int v = nodeOf[link->getRemoteNode()->getModule()];
+                in[v].push_back(make_pair(u, link->getLocalGate()->getIndex()));
+            }
+        }
+        
+        // nextGate[d * R + r], hops[d * R + r]; -1 = unreachable
+        size_t numRouters = routers.size();
+        vector<int> nextGate(n * numRouters, -1);
+        vector<int> hops(n * numRouters, -1);
+        atomic<int> nextDest(0);
+        auto worker = [&] {
+            vector<int> dist(n);
+            vector<int> frontier;
+            for (int d = nextDest++; d < n; d = nextDest++) {
+                fill(dist.begin(), dist.end(), -1);
+                frontier.assign(1, d);
+                dist[d] = 0;
+                for (size_t k = 0; k < frontier.size(); k++) {
+                    int v = frontier[k];
+                    if (v != d && routerIndex[v] < 0) continue;  // Hosts don't forward
+                    for (auto& link : in[v]) {
+                        int u = link.first;
+                        if (dist[u] >= 0) continue;
+                        dist[u] = dist[v] + 1;
+                        nextGate[d * numRouters + routerIndex[u]] = link.second;
+                        hops[d * numRouters + routerIndex[u]] = dist[u];
+                        frontier.push_back(u);
+                    }
+                }
+            }
+        };
+        int threads = par("oracleThreads");
+        if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+        threads = min(threads, max(1, n));
+        vector<thread> workers;
+        for (int t = 1; t < threads; t++) workers.emplace_back(worker);
+        worker();
+        for (auto& t : workers) t.join();
+        
+        long installed = 0;
+        for (size_t r = 0; r < numRouters; r++) {
+            auto& fib = oracleRoutes.fib[routers[r]];
+            for (int d = 0; d < n; d++) {
+                int g = nextGate[d * numRouters + r];
+                if (g >= 0) {
+                    fib[addrs[d]] = make_pair(g, hops[d * numRouters + r]);
+                    installed++;
+                }
+            }
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        EV_INFO << "ORACLE routing: " << n << " nodes, " << numRouters << " routers, "
+                << installed << " routes in " << ms << " ms on " << threads << " threads\n";
+    }
+    
+    void initializeBGP() {
+        bgpRouteReflector = par("bgpRouteReflector").boolValue();
+        bgpLocalPref = par("bgpLocalPref");
+        bgpMRAI = par("bgpMRAI").doubleValue();
+        bgpIbgpMRAI = par("bgpIbgpMRAI").doubleValue();
+        bgpKeepaliveInterval = par("bgpKeepaliveInterval").doubleValue();
+        bgpHoldTime = par("bgpHoldTime").doubleValue();
+        bgpRibVector.setName("bgpLocRibSize");
+        
+        // Sessions: "*" = every gate, else a list of gate indices
+        string sessions = par("bgpSessions").stdstringValue();
+        stringstream ss(sessions);
+        string item;
+        while (getline(ss, item, ',')) {
+            if (item == "*") {
+                for (int i = 0; i < gateSize("pppg"); i++) bgpPeers[i].gate = i;
+            } else if (!item.empty()) {
+                int g = atoi(item.c_str());
+                if (g >= 0 && g < gateSize("pppg")) bgpPeers[g].gate = g;
+            }
+        }
+        for (auto& entry : bgpPeers) {
+            entry.second.mraiTimer = new cMessage("bgpMRAI");
+        }
+        
+        // Redistribute static routes that point away from BGP sessions,
+        // plus synthetic prefixes for RIB-size scaling experiments
+        for (auto& entry : routingTable) {
+            if (!bgpPeers.count(entry.second.nextHop)) {
+                BGPRoute r;
+                r.prefix = entry.first;
+                bgpOriginated[r.prefix] = r;
+            }
+        }
+        int synthetic = par("bgpSyntheticPrefixes");
+        for (int i = 0; i < synthetic; i++) {
+            BGPRoute r;
+            r.prefix = asNumber * 10000000L + i;
+            bgpOriginated[r.prefix] = r;
+        }
+        for (auto& entry : bgpOriginated) {
+            bgpDecide(entry.first);
+        }
+        
+        bgpKeepaliveTimer = new cMessage("bgpKeepalive");
+        scheduleAt(simTime() + uniform(0, 1), bgpKeepaliveTimer);
+        
+        EV_INFO << "Router " << routerId << " BGP AS" << asNumber << " with "
+                << bgpPeers.size() << " session gates, originating "
+                << bgpOriginated.size() << " prefixes\n";
+    }
+    
     void handleMessage(cMessage *msg) override {
         if (msg->isSelfMessage()) {
             handleSelfMessage(msg);
@@ -109,20 +515,17 @@ class Router : public cSimpleModule {
         int kind = msg->getKind();
         
         // Handle routing protocol messages
-        if (kind == OSPF_HELLO) {
-            handleOSPFHello(msg);
-            return;
-        } else if (kind == OSPF_LSA || kind == OSPF_TE_UPDATE) {
-            handleOSPFLSA(msg);
-            return;
-        } else if (kind == RIP_UPDATE) {
-            handleRIPUpdate(msg);
-            return;
-        } else if (kind == RIP_REQUEST) {
-            handleRIPRequest(msg);
+        if (isRoutingMessage(msg)) {
+            if (controlPlaneProtection) {
+                punt(msg);
+            } else {
+                handleRoutingMessage(msg);
+            }
             return;
         }
         
+        if (diffserv) conditionIngress(msg);
+        
         // SYN flood protection
         if (kind == TCP_SYN) {
             long src = SRC(msg);
@@ -130,7 +533,7 @@ class Router : public cSimpleModule {
             if (synCounts[src] > synRateLimit) {
                 EV_WARN << "Router " << routerId << " dropping SYN from " << src 
                         << " - rate limit exceeded\n";
-                delete msg;
+                pool.release(msg);
                 return;
             }
         }
@@ -139,11 +542,68 @@ class Router : public cSimpleModule {
         forwardPacket(msg);
     }
     
+    void handleRoutingMessage(cMessage* msg) {
+        int kind = msg->getKind();
+        if (kind == OSPF_HELLO) {
+            handleOSPFHello(msg);
+        } else if (kind == OSPF_LSA || kind == OSPF_TE_UPDATE) {
+            handleOSPFLSA(msg);
+        } else if (kind == RIP_UPDATE) {
+            handleRIPUpdate(msg);
+        } else if (kind == RIP_REQUEST) {
+            handleRIPRequest(msg);
+        } else if (kind == BFD_CONTROL) {
+            handleBFDControl(msg);
+        } else {
+            handleBGPMessage(msg);
+        }
+    }
+    
+    // Hands a routing message to the route processor. When the punt queue
+    // is full a Hello (or BFD packet) displaces the newest other message,
+    // anything else is dropped.
+    void punt(cMessage* msg) {
+        puntedPackets++;
+        int q = msg->getKind() == OSPF_HELLO || msg->getKind() == BFD_CONTROL ? 0 : 1;
+        if ((int)(puntQueue[0].size() + puntQueue[1].size()) >= controlQueueLimit) {
+            puntDrops++;
+            if (q == 1 || puntQueue[1].empty()) {
+                EV_WARN << "Router " << routerId << " punt queue full, dropped " << msg->getName() << "\n";
+                pool.release(msg);
+                return;
+            }
+            pool.release(puntQueue[1].back());
+            puntQueue[1].pop_back();
+        }
+        puntQueue[q].push_back(msg);
+        if (!puntTimer->isScheduled()) scheduleAt(max(simTime(), puntFree), puntTimer);
+    }
+    
+    void processPunted() {
+        int q = puntQueue[0].empty() ? 1 : 0;
+        cMessage* msg = puntQueue[q].front();
+        puntQueue[q].pop_front();
+        puntFree = simTime() + 1.0 / controlPlaneRate;
+        handleRoutingMessage(msg);
+        if (!puntQueue[0].empty() || !puntQueue[1].empty()) scheduleAt(puntFree, puntTimer);
+    }
+    
     void handleSelfMessage(cMessage* msg) {
-        if (msg == ospfHelloTimer) {
+        if (msg == ospfSPFTimer) {
+            computeOSPFRoutes();
+        } else if (msg == puntTimer) {
+            processPunted();
+        } else if (msg == bfdTimer) {
+            bfdTick();
+            scheduleAt(simTime() + bfdInterval, bfdTimer);
+        } else if (msg == linkFailTimer) {
+            failLink(failGate);
+        } else if (msg == ospfHelloTimer) {
+            checkAdjacencies();
             sendOSPFHello();
             scheduleAt(simTime() + ospfHelloInterval, ospfHelloTimer);
         } else if (msg == ospfLSATimer) {
+            ageLSDB();
             sendOSPFLSA();
             scheduleAt(simTime() + ospfLSAInterval, ospfLSATimer);
         } else if (msg == ripUpdateTimer) {
@@ -151,26 +611,59 @@ class Router : public cSimpleModule {
             scheduleAt(simTime() + ripUpdateInterval, ripUpdateTimer);
         } else if (msg == rateLimitResetTimer) {
             synCounts.clear();  // Reset SYN counters
+            errorsThisSecond = 0;
             scheduleAt(simTime() + 1.0, rateLimitResetTimer);
+        } else if (msg == shaperTimer) {
+            shaper.releaseDue([this](cMessage* m, int g) { sendPacketOnGate(m, g); });
+            scheduleShaper();
+        } else if (msg == bgpKeepaliveTimer) {
+            sendBGPKeepalives();
+            scheduleAt(simTime() + bgpKeepaliveInterval, bgpKeepaliveTimer);
         } else {
+            // MRAI expiry: send whatever accumulated while the timer ran
+            for (auto& entry : bgpPeers) {
+                if (msg == entry.second.mraiTimer) {
+                    bgpFlush(entry.second);
+                    return;
+                }
+            }
+            
             // Handle end of transmission events
             for (int i = 0; i < gateSize("pppg"); i++) {
                 if (msg == endTxEvent[i]) {
-                    endTxEvent[i] = nullptr;
+                    // Routing messages go first
+                    if (!controlTxQueue[i].empty()) {
+                        cMessage* nextMsg = controlTxQueue[i].front();
+                        controlTxQueue[i].pop_front();
+                        startTransmission(nextMsg, i);
+                        return;
+                    }
+                    
                     // Send next packet in queue if available
-                    if (!txQueue[i].isEmpty()) {
-                        cMessage* nextMsg = (cMessage*)txQueue[i].pop();
+                    simtime_t delay;
+                    long queued = txQueue[i].getBytes();
+                    cMessage* nextMsg = txQueue[i].pop([this](cMessage* m) { pool.release(m); }, delay);
+                    buffer.release(queued - txQueue[i].getBytes());
+                    if (nextMsg) {
+                        queueDelayTotal += delay;
+                        queueDelayVector.record(delay);
                         startTransmission(nextMsg, i);
                     }
                     return;
                 }
             }
-            delete msg;
+            pool.release(msg);
         }
     }
     
     void startTransmission(cMessage* msg, int gateIndex) {
         cGate* outGate = gate("pppg$o", gateIndex);
+        auto* channel = dynamic_cast<cDatarateChannel*>(outGate->getTransmissionChannel());
+        if (channel && channel->isDisabled()) {
+            linkFailureDrops++;
+            pool.release(msg);
+            return;
+        }
         
         // Send the packet
         send(msg, outGate);
@@ -178,9 +671,7 @@ class Router : public cSimpleModule {
         // Schedule end of transmission event
         simtime_t finishTime = outGate->getTransmissionChannel()->getTransmissionFinishTime();
         if (finishTime > simTime()) {
-            if (endTxEvent[gateIndex] == nullptr) {
-                endTxEvent[gateIndex] = new cMessage("endTx");
-            } else if (endTxEvent[gateIndex]->isScheduled()) {
+            if (endTxEvent[gateIndex]->isScheduled()) {
                 cancelEvent(endTxEvent[gateIndex]);
             }
             scheduleAt(finishTime, endTxEvent[gateIndex]);
@@ -193,8 +684,28 @@ class Router : public cSimpleModule {
         // Check if channel is busy
         if (outGate->getTransmissionChannel()) {
             simtime_t finishTime = outGate->getTransmissionChannel()->getTransmissionFinishTime();
+            if (finishTime > simTime() && controlPlaneProtection && isRoutingMessage(msg)) {
+                // Routing messages bypass the data queue and the shared buffer
+                controlTxQueue[gateIndex].push_back(msg);
+                return;
+            }
             if (finishTime > simTime()) {
-                // Channel is busy, queue the packet
+                // Channel is busy, queue the packet if the shared buffer has room
+                cPacket* pkt = dynamic_cast<cPacket*>(msg);
+                long bytes = pkt ? pkt->getByteLength() : 0;
+                if (!buffer.admit(gateIndex, PRIORITY(msg), txQueue[gateIndex].getBytes(), bytes)) {
+                    EV_WARN << "Router " << routerId << " buffer full, dropped packet for gate "
+                            << gateIndex << " (" << buffer.getUsed() << " bytes in use)\n";
+                    pool.release(msg);
+                    return;
+                }
+                int length = txQueue[gateIndex].getLength();
+                if (ecnThreshold > 0 && length >= ecnThreshold && msg->hasPar("ecn")) {
+                    msg->par("ecn").setLongValue(ECN_CE);
+                    ecnMarked++;
+                }
+                maxQueueLength = max(maxQueueLength, length + 1);
+                queuedPackets++;
                 txQueue[gateIndex].insert(msg);
                 EV_INFO << "Router " << routerId << " queued packet on gate " << gateIndex << "\n";
                 return;
@@ -210,57 +721,181 @@ class Router : public cSimpleModule {
         for (int i = 0; i < gateSize("pppg"); i++) {
             auto* hello = mk("OSPF_HELLO", OSPF_HELLO, routerId, -1);
             hello->par("priority").setLongValue(PRIORITY_HIGH);
+            hello->setTimestamp();
             sendPacketOnGate(hello, i);
         }
         EV_INFO << "Router " << routerId << " sent OSPF Hello\n";
     }
     
+    // Cost based on available bandwidth, in (0, 1]
+    double ospfLinkCost(int gateIndex) {
+        return 1.0 / (max(linkBandwidth[gateIndex] - linkUtilization[gateIndex], 0.0) + 1);
+    }
+    
+    // Link State Advertisement with Traffic Engineering info. A router link
+    // whose adjacency is down is advertised as down, which withdraws it.
     void sendOSPFLSA() {
-        // Send Link State Advertisement with Traffic Engineering info
+        ospfLSASeq++;
         for (int i = 0; i < gateSize("pppg"); i++) {
+            if (neighborAddr[i] < 0) continue;
             LinkState ls;
             ls.routerId = routerId;
             ls.linkId = i;
-            ls.cost = 1.0 / (linkBandwidth[i] - linkUtilization[i] + 1); // Cost based on available BW
+            ls.cost = ospfLinkCost(i);
             ls.bandwidth = linkBandwidth[i] - linkUtilization[i];
             ls.delay = 1.0;  // Could be measured
             ls.timestamp = simTime();
             
             auto* lsa = mk("OSPF_LSA", OSPF_TE_UPDATE, routerId, -1);
-            lsa->addPar("linkId").setLongValue(i);
-            lsa->addPar("cost").setDoubleValue(ls.cost);
-            lsa->addPar("bandwidth").setDoubleValue(ls.bandwidth);
-            lsa->addPar("delay").setDoubleValue(ls.delay);
+            pool.addPar(lsa, "linkId").setLongValue(i);
+            pool.addPar(lsa, "neighbor").setLongValue(neighborAddr[i]);
+            pool.addPar(lsa, "transit").setBoolValue(neighborIsRouter[i]);
+            pool.addPar(lsa, "lsaSeq").setLongValue(ospfLSASeq);
+            if (neighborIsRouter[i] && !adjacencyUp[i]) pool.addPar(lsa, "down").setBoolValue(true);
+            pool.addPar(lsa, "cost").setDoubleValue(ls.cost);
+            pool.addPar(lsa, "bandwidth").setDoubleValue(ls.bandwidth);
+            pool.addPar(lsa, "delay").setDoubleValue(ls.delay);
             lsa->par("priority").setLongValue(PRIORITY_HIGH);
             
-            // Flood to all neighbors
+            // Flood to all neighboring routers; hosts have no use for LSAs
             for (int j = 0; j < gateSize("pppg"); j++) {
-                if (j != i) {
-                    sendPacketOnGate(lsa->dup(), j);
+                if (neighborIsRouter[j]) {
+                    sendPacketOnGate(pool.dup(lsa), j);
                 }
             }
-            delete lsa;
+            pool.release(lsa);
         }
         EV_INFO << "Router " << routerId << " sent OSPF-TE LSA\n";
     }
     
     void handleOSPFHello(cMessage* msg) {
         long neighborId = SRC(msg);
+        int g = msg->getArrivalGate()->getIndex();
+        simtime_t delay = simTime() - msg->getTimestamp();
+        helloDelayVector.record(delay);
+        maxHelloDelay = max(maxHelloDelay, delay);
+        lastHello[g] = simTime();
+        if (!adjacencyUp[g] && (!bfd || bfdState[g] == BFD_UP)) setAdjacency(g, true);
         EV_INFO << "Router " << routerId << " received OSPF Hello from " << neighborId << "\n";
-        delete msg;
+        pool.release(msg);
+    }
+    
+    // Adjacencies whose Hellos stopped arriving
+    void checkAdjacencies() {
+        for (int i = 0; i < gateSize("pppg"); i++) {
+            if (neighborIsRouter[i] && adjacencyUp[i] && simTime() - lastHello[i] > ospfDeadInterval) {
+                setAdjacency(i, false);
+            }
+        }
+    }
+    
+    void setAdjacency(int g, bool up) {
+        adjacencyUp[g] = up;
+        if (up) {
+            adjacencyDownTime += simTime() - adjacencyDownSince[g];
+            EV_INFO << "Router " << routerId << " adjacency to " << neighborAddr[g] << " up\n";
+        } else {
+            adjacencyDowns++;
+            adjacencyDownSince[g] = simTime();
+            EV_WARN << "Router " << routerId << " adjacency to " << neighborAddr[g] << " down\n";
+        }
+        if (ospfSPFTimer && !ospfSPFTimer->isScheduled()) {
+            scheduleAt(simTime() + ospfSPFDelay, ospfSPFTimer);
+        }
+        if (ospfLSATimer) sendOSPFLSA();  // Tell the area now, not at the next LSA round
+    }
+    
+    // One tick for all sessions: detection timeouts, then a control packet
+    // on every router link
+    void bfdTick() {
+        simtime_t detectTime = bfdInterval * bfdMultiplier;
+        for (int i = 0; i < gateSize("pppg"); i++) {
+            if (!neighborIsRouter[i]) continue;
+            if (bfdState[i] != BFD_DOWN && simTime() - bfdLastRx[i] > detectTime) {
+                bfdSessionDown(i, "detection time expired");
+            }
+            auto* ctl = mk("BFD_CONTROL", BFD_CONTROL, routerId, neighborAddr[i]);
+            pool.addPar(ctl, "bfdState").setLongValue(bfdState[i]);
+            ctl->par("priority").setLongValue(PRIORITY_CRITICAL);
+            ctl->setByteLength(24);
+            sendPacketOnGate(ctl, i);
+        }
+    }
+    
+    // RFC 5880 three-way handshake: DOWN -> INIT on the peer's DOWN,
+    // INIT -> UP once the peer reports INIT or UP; UP -> DOWN on the peer's
+    // DOWN. A peer's UP while we are DOWN is ignored: it is a session we
+    // have not joined yet, and our DOWN makes the peer start over.
+    void handleBFDControl(cMessage* msg) {
+        int g = msg->getArrivalGate()->getIndex();
+        int remote = msg->par("bfdState").longValue();
+        pool.release(msg);
+        if (!bfd || !neighborIsRouter[g]) return;
+        bfdLastRx[g] = simTime();
+        int& state = bfdState[g];
+        if (state == BFD_UP) {
+            if (remote == BFD_DOWN) bfdSessionDown(g, "neighbor signalled down");
+        } else if (state == BFD_DOWN) {
+            if (remote == BFD_DOWN) state = BFD_INIT;
+        } else if (remote != BFD_DOWN) {
+            state = BFD_UP;
+            EV_INFO << "Router " << routerId << " BFD session to " << neighborAddr[g] << " up\n";
+            if (!adjacencyUp[g] && simTime() - lastHello[g] <= ospfDeadInterval) setAdjacency(g, true);
+        }
+    }
+    
+    void bfdSessionDown(int g, const char* reason) {
+        bfdState[g] = BFD_DOWN;
+        bfdSessionDowns++;
+        EV_WARN << "Router " << routerId << " BFD session to " << neighborAddr[g] << " down: "
+                << reason << "\n";
+        if (adjacencyUp[g]) {
+            setAdjacency(g, false);
+            if (ospfSPFTimer) {
+                cancelEvent(ospfSPFTimer);
+                computeOSPFRoutes();  // No SPF hold-down: BFD means the link is gone
+            }
+        }
+        for (auto& entry : bgpPeers) {
+            if (entry.second.gate == g && entry.second.established) bgpSessionDown(entry.second);
+        }
+    }
+    
+    // Takes gate g's link down in both directions, as a cut cable would
+    void failLink(int g) {
+        cGate* out = gate("pppg$o", g);
+        cGate* remote = out->getPathEndGate();
+        check_and_cast<cDatarateChannel*>(out->getTransmissionChannel())->setDisabled(true);
+        cGate* back = remote->getOwnerModule()->gate("pppg$o", remote->getIndex());
+        check_and_cast<cDatarateChannel*>(back->getTransmissionChannel())->setDisabled(true);
+        EV_WARN << "Router " << routerId << " link on gate " << g << " to " << neighborAddr[g]
+                << " failed\n";
     }
     
     void handleOSPFLSA(cMessage* msg) {
         long originRouter = SRC(msg);
         int linkId = msg->par("linkId").longValue();
+        long seq = msg->par("lsaSeq").longValue();
+        
+        // Our own LSA coming back, or a copy already seen on another path
+        auto known = linkStateDB.find(originRouter * 1000 + linkId);
+        if (originRouter == routerId || (known != linkStateDB.end() && known->second.seq >= seq)) {
+            pool.release(msg);
+            return;
+        }
         double cost = msg->par("cost").doubleValue();
         double bandwidth = msg->par("bandwidth").doubleValue();
         double delay = msg->par("delay").doubleValue();
         
-        // Update link state database
+        // Update link state database; a withdrawn link stays in it as down,
+        // so older copies still in flight cannot bring it back
         LinkState ls;
         ls.routerId = originRouter;
         ls.linkId = linkId;
+        ls.neighbor = msg->par("neighbor").longValue();
+        ls.transit = msg->par("transit").boolValue();
+        ls.down = msg->hasPar("down") && msg->par("down").boolValue();
+        ls.seq = seq;
         ls.cost = cost;
         ls.bandwidth = bandwidth;
         ls.delay = delay;
@@ -268,54 +903,142 @@ class Router : public cSimpleModule {
         
         linkStateDB[originRouter * 1000 + linkId] = ls;
         
-        // Recompute routes using Dijkstra with TE constraints
-        computeOSPFRoutes();
+        // Recompute routes shortly; one SPF run covers a burst of LSAs
+        if (ospfSPFTimer && !ospfSPFTimer->isScheduled()) {
+            scheduleAt(simTime() + ospfSPFDelay, ospfSPFTimer);
+        }
         
-        // Flood LSA to other neighbors (except where it came from)
+        // Flood LSA to other neighboring routers (except where it came from)
         int inGate = msg->getArrivalGate()->getIndex();
         for (int i = 0; i < gateSize("pppg"); i++) {
-            if (i != inGate) {
-                sendPacketOnGate(msg->dup(), i);
+            if (i != inGate && neighborIsRouter[i]) {
+                sendPacketOnGate(pool.dup(msg), i);
             }
         }
-        delete msg;
+        pool.release(msg);
         
         EV_INFO << "Router " << routerId << " processed OSPF-TE LSA from " << originRouter << "\n";
     }
     
+    // Purges LSDB entries their origin stopped refreshing, e.g. because it
+    // is unreachable now
+    void ageLSDB() {
+        int purged = 0;
+        for (auto it = linkStateDB.begin(); it != linkStateDB.end();) {
+            if (simTime() - it->second.timestamp > ospfLSAMaxAge) {
+                it = linkStateDB.erase(it);
+                purged++;
+            } else {
+                ++it;
+            }
+        }
+        if (purged > 0) {
+            EV_INFO << "Router " << routerId << " aged out " << purged << " LSAs\n";
+            if (!ospfSPFTimer->isScheduled()) scheduleAt(simTime() + ospfSPFDelay, ospfSPFTimer);
+        }
+    }
+    
+    // Dijkstra over the LSDB with the advertised TE costs. Our own links
+    // come from the wiring; hosts are leaves. Direct, static and BGP routes
+    // take precedence over OSPF ones.
     void computeOSPFRoutes() {
-        // Simplified Dijkstra with Traffic Engineering
-        // In a full implementation, this would use the link state database
-        // to compute shortest paths considering bandwidth and delay constraints
-        EV_INFO << "Router " << routerId << " recomputing OSPF routes\n";
+        map<long, vector<const LinkState*>> links;  // router -> advertised links
+        for (auto& entry : linkStateDB) {
+            if (entry.second.down) continue;  // Withdrawn by its origin
+            links[entry.second.routerId].push_back(&entry.second);
+        }
+        
+        map<long, double> dist;
+        map<long, int> firstGate;
+        map<long, int> hops;
+        typedef pair<double, long> Candidate;
+        priority_queue<Candidate, vector<Candidate>, greater<Candidate>> frontier;
+        for (int i = 0; i < gateSize("pppg"); i++) {
+            long nb = neighborAddr[i];
+            if (nb < 0 || (neighborIsRouter[i] && !adjacencyUp[i])) continue;
+            double cost = ospfLinkCost(i);
+            if (!dist.count(nb) || cost < dist[nb]) {
+                dist[nb] = cost;
+                firstGate[nb] = i;
+                hops[nb] = 1;
+                if (neighborIsRouter[i]) frontier.push(make_pair(cost, nb));
+            }
+        }
+        while (!frontier.empty()) {
+            Candidate top = frontier.top();
+            frontier.pop();
+            long u = top.second;
+            if (top.first > dist[u]) continue;  // Stale entry
+            for (const LinkState* ls : links[u]) {
+                long v = ls->neighbor;
+                if (v < 0 || v == routerId) continue;
+                double d = top.first + ls->cost;
+                auto it = dist.find(v);
+                if (it == dist.end() || d < it->second) {
+                    dist[v] = d;
+                    firstGate[v] = firstGate[u];
+                    hops[v] = hops[u] + 1;
+                    if (ls->transit) frontier.push(make_pair(d, v));
+                }
+            }
+        }
+        
+        int changed = 0;
+        for (auto& entry : dist) {
+            long dest = entry.first;
+            auto it = routingTable.find(dest);
+            if (it != routingTable.end() && !ospfInstalled.count(dest)) continue;
+            if (it == routingTable.end() || it->second.nextHop != firstGate[dest]) changed++;
+            RouteEntry re;
+            re.destAddr = dest;
+            re.nextHop = firstGate[dest];
+            re.metric = entry.second;
+            re.hopCount = hops[dest];
+            re.bandwidth = linkBandwidth[re.nextHop];
+            re.delay = 1.0;
+            re.lastUpdate = simTime();
+            routingTable[dest] = re;
+            ospfInstalled.insert(dest);
+        }
+        for (auto it = ospfInstalled.begin(); it != ospfInstalled.end();) {
+            if (!dist.count(*it)) {
+                routingTable.erase(*it);
+                it = ospfInstalled.erase(it);
+                changed++;
+            } else {
+                ++it;
+            }
+        }
+        EV_INFO << "Router " << routerId << " recomputed OSPF routes: " << ospfInstalled.size()
+                << " learned, " << changed << " changed\n";
     }
     
     void sendRIPUpdate() {
-        // Send RIP distance vector updates
+        // Send RIP distance vector updates; the table is serialized once
+        // and the copies for each neighbor share it
+        stringstream ss;
+        for (auto& entry : routingTable) {
+            ss << entry.first << ":" << entry.second.metric << ":" 
+               << entry.second.hopCount << ",";
+        }
+        
+        auto* update = mk("RIP_UPDATE", RIP_UPDATE, routerId, -1);
+        setPayload(pool.addPar(update, "routes"), ss.str());
+        update->par("priority").setLongValue(PRIORITY_NORMAL);
+        
         for (int i = 0; i < gateSize("pppg"); i++) {
-            auto* update = mk("RIP_UPDATE", RIP_UPDATE, routerId, -1);
-            
-            // Add routing table entries to message
-            stringstream ss;
-            for (auto& entry : routingTable) {
-                ss << entry.first << ":" << entry.second.metric << ":" 
-                   << entry.second.hopCount << ",";
-            }
-            update->addPar("routes").setStringValue(ss.str().c_str());
-            update->par("priority").setLongValue(PRIORITY_NORMAL);
-            
-            sendPacketOnGate(update, i);
+            sendPacketOnGate(pool.dup(update), i);
         }
+        pool.release(update);
         EV_INFO << "Router " << routerId << " sent RIP update\n";
     }
     
     void handleRIPUpdate(cMessage* msg) {
         long neighborId = SRC(msg);
         int inGate = msg->getArrivalGate()->getIndex();
-        string routes = msg->par("routes").stringValue();
         
         // Parse received routes
-        stringstream ss(routes);
+        stringstream ss(getPayload(msg, "routes"));
         string item;
         bool routeChanged = false;
         
@@ -347,17 +1070,291 @@ class Router : public cSimpleModule {
                     << neighborId << "\n";
         }
         
-        delete msg;
+        pool.release(msg);
     }
     
     void handleRIPRequest(cMessage* msg) {
         // Respond to RIP request with full routing table
         sendRIPUpdate();
-        delete msg;
+        pool.release(msg);
+    }
+    
+    // ==================== BGP ====================
+    
+    void handleBGPMessage(cMessage* msg) {
+        int inGate = msg->getArrivalGate()->getIndex();
+        auto it = bgpPeers.find(inGate);
+        if (asNumber <= 0 || it == bgpPeers.end()) {
+            pool.release(msg);  // Not a BGP speaker on this link
+            return;
+        }
+        BGPPeer& peer = it->second;
+        peer.lastHeard = simTime();
+        peer.routerId = SRC(msg);
+        peer.remoteAS = msg->par("asNumber").longValue();
+        
+        if (!peer.established) {
+            // Session comes up on the first message; send the full table
+            peer.established = true;
+            EV_INFO << "Router " << routerId << " BGP session up with " << peer.routerId
+                    << " (AS" << peer.remoteAS << (peer.ibgp(asNumber) ? ", iBGP" : ", eBGP")
+                    << ") on gate " << inGate << "\n";
+            for (auto& entry : locRib) peer.pending.insert(entry.first);
+            if (!peer.mraiTimer->isScheduled()) bgpFlush(peer);
+        }
+        
+        if (msg->getKind() == BGP_UPDATE) {
+            handleBGPUpdate(msg, peer);
+        }
+        pool.release(msg);
+    }
+    
+    void handleBGPUpdate(cMessage* msg, BGPPeer& peer) {
+        bgpUpdatesReceived++;
+        set<long> touched;
+        
+        stringstream withdrawn(getPayload(msg, "withdrawn"));
+        string item;
+        while (getline(withdrawn, item, ',')) {
+            if (item.empty()) continue;
+            long prefix = atol(item.c_str());
+            peer.adjRibIn.erase(prefix);
+            touched.insert(prefix);
+        }
+        
+        stringstream routes(getPayload(msg, "routes"));
+        while (getline(routes, item, ';')) {
+            if (item.empty()) continue;
+            BGPRoute r;
+            if (!parseBGPRoute(item, r)) continue;
+            touched.insert(r.prefix);
+            
+            // Loop prevention: our AS in the path, or our own reflected route
+            bool loop = find(r.asPath.begin(), r.asPath.end(), asNumber) != r.asPath.end() ||
+                        r.originatorId == routerId ||
+                        find(r.clusterList.begin(), r.clusterList.end(), routerId) != r.clusterList.end();
+            if (loop) {
+                peer.adjRibIn.erase(r.prefix);
+                continue;
+            }
+            r.peerGate = peer.gate;
+            r.peerRouterId = peer.routerId;
+            r.ibgp = peer.ibgp(asNumber);
+            if (!r.ibgp) {
+                r.localPref = bgpLocalPref;  // LOCAL_PREF is not carried across ASes
+            }
+            peer.adjRibIn[r.prefix] = r;
+        }
+        
+        for (long prefix : touched) {
+            bgpDecide(prefix);
+        }
+    }
+    
+    // "prefix|localPref|med|originator|as as ...|cluster cluster ..."
+    static string encodeBGPRoute(const BGPRoute& r) {
+        stringstream ss;
+        ss << r.prefix << "|" << r.localPref << "|" << r.med << "|" << r.originatorId << "|";
+        for (size_t i = 0; i < r.asPath.size(); i++) ss << (i ? " " : "") << r.asPath[i];
+        ss << "|";
+        for (size_t i = 0; i < r.clusterList.size(); i++) ss << (i ? " " : "") << r.clusterList[i];
+        return ss.str();
+    }
+    
+    static bool parseBGPRoute(const string& text, BGPRoute& r) {
+        vector<string> fields;
+        stringstream ss(text);
+        string field;
+        while (getline(ss, field, '|')) fields.push_back(field);
+        if (fields.size() < 4) return false;
+        r.prefix = atol(fields[0].c_str());
+        r.localPref = atol(fields[1].c_str());
+        r.med = atol(fields[2].c_str());
+        r.originatorId = atol(fields[3].c_str());
+        long v;
+        if (fields.size() > 4) {
+            stringstream path(fields[4]);
+            while (path >> v) r.asPath.push_back(v);
+        }
+        if (fields.size() > 5) {
+            stringstream clusters(fields[5]);
+            while (clusters >> v) r.clusterList.push_back(v);
+        }
+        return true;
+    }
+    
+    // Best-path selection: LOCAL_PREF, AS path length, MED (same neighbor
+    // AS only), eBGP over iBGP, shorter cluster list, lowest peer router id
+    bool bgpBetter(const BGPRoute& a, const BGPRoute& b) const {
+        if (a.localPref != b.localPref) return a.localPref > b.localPref;
+        if (a.asPath.size() != b.asPath.size()) return a.asPath.size() < b.asPath.size();
+        if (!a.asPath.empty() && !b.asPath.empty() && a.asPath[0] == b.asPath[0] && a.med != b.med) {
+            return a.med < b.med;
+        }
+        if (a.ibgp != b.ibgp) return !a.ibgp;
+        if (a.clusterList.size() != b.clusterList.size()) return a.clusterList.size() < b.clusterList.size();
+        return a.peerRouterId < b.peerRouterId;
+    }
+    
+    // Re-runs selection for one prefix and schedules exports if the best changed
+    void bgpDecide(long prefix) {
+        const BGPRoute* best = nullptr;
+        auto orig = bgpOriginated.find(prefix);
+        if (orig != bgpOriginated.end()) {
+            best = &orig->second;  // Locally originated routes always win
+        } else {
+            for (auto& entry : bgpPeers) {
+                if (!entry.second.established) continue;
+                auto r = entry.second.adjRibIn.find(prefix);
+                if (r != entry.second.adjRibIn.end() && (!best || bgpBetter(r->second, *best))) {
+                    best = &r->second;
+                }
+            }
+        }
+        
+        auto current = locRib.find(prefix);
+        if (best && current != locRib.end() && current->second.peerGate == best->peerGate &&
+            encodeBGPRoute(current->second) == encodeBGPRoute(*best)) {
+            return;  // Unchanged
+        }
+        if (!best && current == locRib.end()) return;
+        
+        if (best) {
+            locRib[prefix] = *best;
+            if (best->peerGate >= 0 && (!routingTable.count(prefix) || bgpInstalled.count(prefix))) {
+                RouteEntry re;
+                re.destAddr = prefix;
+                re.nextHop = best->peerGate;
+                re.metric = best->asPath.size() + 1;
+                re.hopCount = best->asPath.size() + 1;
+                re.lastUpdate = simTime();
+                routingTable[prefix] = re;
+                bgpInstalled.insert(prefix);
+            }
+        } else {
+            locRib.erase(prefix);
+            if (bgpInstalled.erase(prefix)) routingTable.erase(prefix);
+        }
+        bgpBestPathChanges++;
+        bgpLastChange = simTime();
+        bgpRibVector.record(locRib.size());
+        
+        for (auto& entry : bgpPeers) {
+            BGPPeer& peer = entry.second;
+            if (!peer.established) continue;
+            peer.pending.insert(prefix);
+            if (!peer.mraiTimer->isScheduled()) bgpFlush(peer);
+        }
+    }
+    
+    // Attributes to announce to a peer, or "" if the route must not be sent
+    string bgpExport(const BGPRoute& best, const BGPPeer& peer) const {
+        if (best.peerGate == peer.gate) return "";  // Never back to where it came from
+        BGPRoute out = best;
+        if (!peer.ibgp(asNumber)) {
+            if (find(best.asPath.begin(), best.asPath.end(), peer.remoteAS) != best.asPath.end()) {
+                return "";  // The peer would discard it as a loop
+            }
+            out.asPath.insert(out.asPath.begin(), asNumber);
+            out.localPref = 0;
+            out.originatorId = 0;
+            out.clusterList.clear();
+            if (best.peerGate >= 0) out.med = 0;  // MED does not travel past the next AS
+        } else if (best.ibgp) {
+            // iBGP-learned routes only go to iBGP peers through a route reflector
+            if (!bgpRouteReflector) return "";
+            if (out.originatorId == 0) out.originatorId = best.peerRouterId;
+            out.clusterList.insert(out.clusterList.begin(), routerId);
+        }
+        return encodeBGPRoute(out);
+    }
+    
+    // Sends the pending announcements/withdrawals as one UPDATE and starts MRAI
+    void bgpFlush(BGPPeer& peer) {
+        stringstream routes, withdrawn;
+        int announced = 0, withdrawals = 0;
+        for (long prefix : peer.pending) {
+            auto best = locRib.find(prefix);
+            string attrs = best != locRib.end() ? bgpExport(best->second, peer) : "";
+            auto sent = peer.adjRibOut.find(prefix);
+            if (attrs.empty()) {
+                if (sent != peer.adjRibOut.end()) {
+                    withdrawn << prefix << ",";
+                    peer.adjRibOut.erase(sent);
+                    withdrawals++;
+                }
+            } else if (sent == peer.adjRibOut.end() || sent->second != attrs) {
+                routes << attrs << ";";
+                peer.adjRibOut[prefix] = attrs;
+                announced++;
+            }
+        }
+        peer.pending.clear();
+        if (announced == 0 && withdrawals == 0) return;
+        
+        auto* update = mk("BGP_UPDATE", BGP_UPDATE, routerId, peer.routerId);
+        string routesText = routes.str(), withdrawnText = withdrawn.str();
+        setPayload(pool.addPar(update, "routes"), routesText);
+        setPayload(pool.addPar(update, "withdrawn"), withdrawnText);
+        pool.addPar(update, "asNumber").setLongValue(asNumber);
+        update->par("priority").setLongValue(PRIORITY_HIGH);
+        update->setByteLength(23 + routesText.size() + withdrawnText.size());
+        sendPacketOnGate(update, peer.gate);
+        
+        bgpUpdatesSent++;
+        bgpPrefixesAnnounced += announced;
+        bgpPrefixesWithdrawn += withdrawals;
+        double mrai = peer.ibgp(asNumber) ? bgpIbgpMRAI : bgpMRAI;
+        if (mrai > 0) {
+            scheduleAt(simTime() + mrai * uniform(0.75, 1.0), peer.mraiTimer);  // RFC 4271 jitter
+        }
+        EV_INFO << "Router " << routerId << " BGP UPDATE to " << peer.routerId << ": "
+                << announced << " announced, " << withdrawals << " withdrawn\n";
+    }
+    
+    void sendBGPKeepalives() {
+        simtime_t now = simTime();
+        for (auto& entry : bgpPeers) {
+            BGPPeer& peer = entry.second;
+            if (peer.established && now - peer.lastHeard > bgpHoldTime) {
+                bgpSessionDown(peer);
+            }
+            auto* keepalive = mk("BGP_KEEPALIVE", BGP_KEEPALIVE, routerId, -1);
+            pool.addPar(keepalive, "asNumber").setLongValue(asNumber);
+            keepalive->par("priority").setLongValue(PRIORITY_HIGH);
+            keepalive->setByteLength(19);
+            sendPacketOnGate(keepalive, peer.gate);
+        }
+    }
+    
+    void bgpSessionDown(BGPPeer& peer) {
+        EV_WARN << "Router " << routerId << " BGP hold timer expired for " << peer.routerId
+                << " on gate " << peer.gate << "\n";
+        peer.established = false;
+        peer.pending.clear();
+        peer.adjRibOut.clear();
+        cancelEvent(peer.mraiTimer);
+        map<long, BGPRoute> lost;
+        lost.swap(peer.adjRibIn);
+        for (auto& entry : lost) {
+            bgpDecide(entry.first);
+        }
     }
     
     void forwardPacket(cMessage* msg) {
         long dst = DST(msg);
+        
+        // Hop limit: a packet caught in a routing loop dies here
+        int ttl = TTL(msg) - 1;
+        if (ttl <= 0) {
+            EV_WARN << "Router " << routerId << " TTL expired for packet to " << dst << "\n";
+            ttlDrops++;
+            sendError(msg, TIME_EXCEEDED);
+            pool.release(msg);
+            return;
+        }
+        msg->par("ttl").setLongValue(ttl);
+        
         auto it = routingTable.find(dst);
         
         if (it != routingTable.end()) {
@@ -368,47 +1365,253 @@ class Router : public cSimpleModule {
                 double msgSize = pkt && pkt->getByteLength() > 0 ? pkt->getByteLength() : 1000;
                 linkUtilization[g] += msgSize / 1000000.0;  // Convert to Mbps
                 
-                // Priority-based forwarding
-                int priority = PRIORITY(msg);
-                if (priority >= PRIORITY_HIGH || outputQueues[g].empty()) {
-                    sendPacketOnGate(msg, g);
-                    EV_INFO << "Router " << routerId << " forwarded to gate " << g 
-                            << " (priority " << priority << ")\n";
-                } else {
-                    outputQueues[g].push(msg);
-                    EV_INFO << "Router " << routerId << " queued message for gate " << g << "\n";
+                if (pkt && pkt->getByteLength() > gateMtu[g]) {
+                    if (msg->hasPar("df") && msg->par("df").boolValue()) {
+                        tooBigDrops++;
+                        sendPacketTooBig(pkt, gateMtu[g]);
+                    } else {
+                        fragment(pkt, g);
+                    }
+                    return;
                 }
+                forwardOnGate(msg, g);
                 return;
             }
         }
         
-        // Fallback: flood (skip incoming gate)
-        EV_WARN << "Router " << routerId << " no route to " << dst << ", flooding\n";
-        int inIdx = msg->getArrivalGate()->getIndex();
-        for (int i=0; i<gateSize("pppg"); ++i) {
-            if (i != inIdx) {
-                sendPacketOnGate(msg->dup(), i);
+        // Bounded flood, for discovery experiments only; BGP routers never
+        // flood since copies would loop between ASes
+        if (noRouteFlood && asNumber == 0) {
+            EV_WARN << "Router " << routerId << " no route to " << dst << ", flooding\n";
+            floodedPackets++;
+            msg->par("ttl").setLongValue(min(ttl, floodTTL));
+            int inIdx = msg->getArrivalGate()->getIndex();
+            for (int i = 0; i < gateSize("pppg"); ++i) {
+                if (i != inIdx && neighborAddr[i] >= 0) {
+                    sendPacketOnGate(pool.dup(msg), i);
+                }
             }
+            pool.release(msg);
+            return;
         }
-        delete msg;
+        
+        EV_WARN << "Router " << routerId << " no route to " << dst << ", dropping\n";
+        noRouteDrops++;
+        sendError(msg, DEST_UNREACHABLE);
+        pool.release(msg);
     }
-
+    
+    void forwardOnGate(cMessage* msg, int g) {
+        if (diffserv && shapeRate > 0 && PRIORITY(msg) < PRIORITY_CRITICAL) {
+            shape(msg, g);
+            return;
+        }
+        
+        // Priority-based forwarding
+        int priority = PRIORITY(msg);
+        if (priority >= PRIORITY_HIGH || outputQueues[g].empty()) {
+            sendPacketOnGate(msg, g);
+            EV_INFO << "Router " << routerId << " forwarded to gate " << g 
+                    << " (priority " << priority << ")\n";
+        } else {
+            outputQueues[g].push(msg);
+            EV_INFO << "Router " << routerId << " queued message for gate " << g << "\n";
+        }
+    }
+    
+    // DiffServ ingress: the class comes from the packet kind, whatever
+    // priority the host set; each policer that finds the packet out of
+    // profile remarks it one class down
+    void conditionIngress(cMessage* msg) {
+        cPacket* pkt = dynamic_cast<cPacket*>(msg);
+        long bytes = pkt ? pkt->getByteLength() : 0;
+        int c = diffservClass(msg);
+        classified[c]++;
+        while (c > PRIORITY_LOW && !policers[c].conform(bytes)) {
+            remarked[c]++;
+            c--;
+        }
+        msg->par("priority").setLongValue(c);
+    }
+    
+    // Egress shaper: each gate's packets leave no faster than shapeRate
+    void shape(cMessage* msg, int g) {
+        cPacket* pkt = dynamic_cast<cPacket*>(msg);
+        long bytes = pkt ? pkt->getByteLength() : 0;
+        simtime_t at = max(simTime(), shapeNext[g]);
+        if (!shaper.insert(msg, g, at)) {
+            EV_WARN << "Router " << routerId << " shaper backlog beyond " << shaper.horizon()
+                    << " on gate " << g << ", dropped packet to " << DST(msg) << "\n";
+            shaperDrops++;
+            pool.release(msg);
+            return;
+        }
+        if (at > simTime()) shaperDelayed++;
+        shapeNext[g] = at + bytes * 8 / shapeRate;
+        scheduleShaper();
+    }
+    
+    void scheduleShaper() {
+        if (shaperTimer->isScheduled()) cancelEvent(shaperTimer);
+        if (!shaper.isEmpty()) scheduleAt(max(simTime(), shaper.nextRelease()), shaperTimer);
+    }
+    
+    // Splits pkt into fragments that fit gate g's MTU. Each fragment is a
+    // copy of the packet with its slice of the payload (a multiple of 8
+    // bytes, as in IPv4) behind IP_HEADER_BYTES; a fragment that meets a
+    // smaller MTU further on is split again under the same fragId.
+    void fragment(cPacket* pkt, int g) {
+        long perFragment = max(8, (gateMtu[g] - IP_HEADER_BYTES) / 8 * 8);
+        long payload = pkt->getByteLength() - IP_HEADER_BYTES;
+        long base = 0;
+        if (pkt->hasPar("fragId")) {
+            base = pkt->par("fragOffset").longValue();
+        } else {
+            pool.addPar(pkt, "fragId").setLongValue((routerId << 32) | nextFragId++);
+            pool.addPar(pkt, "fragOffset");
+            pool.addPar(pkt, "fragBytes").setLongValue(pkt->getByteLength());
+        }
+        packetsFragmented++;
+        for (long offset = 0; offset < payload; offset += perFragment) {
+            long len = min(perFragment, payload - offset);
+            cPacket* frag = offset + len < payload ? pool.dup(pkt) : pkt;
+            frag->par("fragOffset").setLongValue(base + offset);
+            frag->setByteLength(len + IP_HEADER_BYTES);
+            fragmentsSent++;
+            forwardOnGate(frag, g);
+        }
+        EV_INFO << "Router " << routerId << " fragmented packet to " << DST(pkt) << " for MTU "
+                << gateMtu[g] << "\n";
+    }
+    
+    // Gate towards the source of msg for an error about it, or -1 when no
+    // error may be sent: errors are rate limited and never sent about
+    // another error, so they cannot multiply
+    int errorGate(cMessage* msg) {
+        int origKind = msg->getKind();
+        if (origKind == DEST_UNREACHABLE || origKind == TIME_EXCEEDED || origKind == PACKET_TOO_BIG) return -1;
+        if (errorsThisSecond >= errorRateLimit) return -1;
+        auto it = routingTable.find(SRC(msg));
+        if (it == routingTable.end() || it->second.nextHop < 0 || it->second.nextHop >= gateSize("pppg")) {
+            return -1;  // Nowhere to send it
+        }
+        return it->second.nextHop;
+    }
+    
+    cPacket* mkError(cMessage* msg, int kind, const char* name) {
+        auto* err = mk(name, kind, routerId, SRC(msg));
+        pool.addPar(err, "origDst").setLongValue(DST(msg));
+        pool.addPar(err, "origKind").setLongValue(msg->getKind());
+        err->par("seq").setLongValue(SEQ(msg));
+        err->par("priority").setLongValue(PRIORITY_HIGH);
+        err->setByteLength(64);
+        errorsThisSecond++;
+        errorsSent++;
+        return err;
+    }
+    
+    // ICMP-style error to the source of msg
+    void sendError(cMessage* msg, int kind) {
+        int g = errorGate(msg);
+        if (g < 0) return;
+        sendPacketOnGate(mkError(msg, kind, kind == TIME_EXCEEDED ? "TIME_EXCEEDED" : "DEST_UNREACHABLE"), g);
+    }
+    
+    // Takes over a Don't Fragment packet larger than mtu. The error quotes
+    // it, cut to its headers like an ICMP quote, so that the source can
+    // resend it without DF.
+    void sendPacketTooBig(cPacket* pkt, int mtu) {
+        int g = errorGate(pkt);
+        if (g < 0) {
+            pool.release(pkt);
+            return;
+        }
+        cPacket* err = mkError(pkt, PACKET_TOO_BIG, "PACKET_TOO_BIG");
+        pool.addPar(err, "mtu").setLongValue(mtu);
+        pool.addPar(err, "origBytes").setLongValue(pkt->getByteLength());
+        pkt->setByteLength(HEADER_BYTES);
+        err->encapsulate(pkt);
+        sendPacketOnGate(err, g);
+    }
+    
     void finish() override {
         cancelAndDelete(ospfHelloTimer);
         cancelAndDelete(ospfLSATimer);
+        cancelAndDelete(ospfSPFTimer);
         cancelAndDelete(ripUpdateTimer);
         cancelAndDelete(rateLimitResetTimer);
+        pool.recordScalars(this);
+        recordScalar("noRouteDrops", noRouteDrops);
+        recordScalar("ttlDrops", ttlDrops);
+        recordScalar("errorsSent", errorsSent);
+        recordScalar("floodedPackets", floodedPackets);
+        recordScalar("packetsFragmented", packetsFragmented);
+        recordScalar("fragmentsSent", fragmentsSent);
+        recordScalar("tooBigDrops", tooBigDrops);
+        recordScalar("ecnMarked", ecnMarked);
+        recordScalar("meanQueueDelay", queuedPackets ? queueDelayTotal.dbl() / queuedPackets : 0.0);
+        recordScalar("maxQueueLength", maxQueueLength);
+        long codelDrops = 0, codelMarks = 0;
+        for (auto& entry : txQueue) {
+            codelDrops += entry.second.codelDrops;
+            codelMarks += entry.second.codelMarks;
+        }
+        recordScalar("codelDrops", codelDrops);
+        recordScalar("codelMarks", codelMarks);
+        buffer.recordScalars(this);
+        if (diffserv) {
+            for (int c = PRIORITY_LOW; c <= PRIORITY_CRITICAL; c++) {
+                recordScalar(("diffservClassified-class" + to_string(c)).c_str(), classified[c]);
+                recordScalar(("diffservRemarked-class" + to_string(c)).c_str(), remarked[c]);
+            }
+            recordScalar("shaperDelayed", shaperDelayed);
+            recordScalar("shaperDrops", shaperDrops);
+        }
+        cancelAndDelete(shaperTimer);
+        shaper.clear();
+        if (routingProtocol == "OSPF-TE") {
+            for (int i = 0; i < gateSize("pppg"); i++) {
+                if (!adjacencyUp[i]) adjacencyDownTime += simTime() - adjacencyDownSince[i];
+            }
+            recordScalar("adjacencyDowns", adjacencyDowns);
+            recordScalar("adjacencyDownTime", adjacencyDownTime);
+            recordScalar("maxHelloDelay", maxHelloDelay);
+        }
+        if (bfd) recordScalar("bfdSessionDowns", bfdSessionDowns);
+        recordScalar("linkFailureDrops", linkFailureDrops);
+        cancelAndDelete(bfdTimer);
+        cancelAndDelete(linkFailTimer);
+        recordScalar("puntedPackets", puntedPackets);
+        recordScalar("puntDrops", puntDrops);
+        cancelAndDelete(puntTimer);
+        for (auto& queue : puntQueue) {
+            for (cMessage* m : queue) delete m;
+        }
+        for (auto& entry : controlTxQueue) {
+            for (cMessage* m : entry.second) delete m;
+        }
+        
+        // The last ORACLE router frees the shared tables for the next run
+        if (routingProtocol == "ORACLE" && --oracleRoutes.users == 0) {
+            oracleRoutes.fib.clear();
+        }
+        
+        if (asNumber > 0) {
+            cancelAndDelete(bgpKeepaliveTimer);
+            for (auto& entry : bgpPeers) cancelAndDelete(entry.second.mraiTimer);
+            recordScalar("bgpUpdatesSent", bgpUpdatesSent);
+            recordScalar("bgpUpdatesReceived", bgpUpdatesReceived);
+            recordScalar("bgpPrefixesAnnounced", bgpPrefixesAnnounced);
+            recordScalar("bgpPrefixesWithdrawn", bgpPrefixesWithdrawn);
+            recordScalar("bgpBestPathChanges", bgpBestPathChanges);
+            recordScalar("bgpLocRibSize", locRib.size());
+            recordScalar("bgpConvergenceTime", bgpLastChange);  // Last loc-RIB change
+        }
         
         // Clean up transmission queues and events
         for (int i = 0; i < gateSize("pppg"); i++) {
-            while (!txQueue[i].isEmpty()) {
-                cMessage* msg = (cMessage*)txQueue[i].pop();
-                delete msg;
-            }
-            if (endTxEvent[i]) {
-                cancelAndDelete(endTxEvent[i]);
-                endTxEvent[i] = nullptr;
-            }
+            txQueue[i].clear();
+            cancelAndDelete(endTxEvent[i]);
         }
         
         // Clear queues
@@ -0,0 +1,281 @@
+#include <omnetpp.h>
+#include "helpers.h"
+#include <map>
+using namespace omnetpp;
+using namespace std;
+
+// Segmented video server: answers VIDEO_REQUEST with the segment split into
+// VIDEO_CHUNK packets. Over TCP the chunks are sent in an ACK-clocked
+// congestion window; over UDP they go out back to back at link rate. Each
+// window's worth of chunks is built as one packet and cut into chunks by
+// segmentation offload at the egress. With ecn, TCP chunks are ECN-capable
+// and the window follows DCTCP. Lost TCP chunks are sent again on three
+// duplicate ACKs (fast retransmit, NewReno-style partial ACKs) or when
+// nothing is acknowledged for retransmitTimeout (go-back-N from the ACK).
+class VideoServer : public cSimpleModule {
+  private:
+    int addr = 0;
+    long chunkBytes;
+    int chunkPriority;
+    bool ecn;                // ECN-capable TCP chunks, DCTCP window response
+    simtime_t retransmitTimeout;
+    
+    // One segment transfer in progress per client
+    struct Transfer {
+        long segment = -1;
+        long request = 0;        // Client's attempt id, echoed in chunks and ACKs
+        long chunks = 0;
+        long bytes = 0;
+        long nextChunk = 0;      // Next chunk to send
+        long acked = 0;          // Chunks acknowledged (TCP)
+        int dupAcks = 0;
+        long recover = 0;        // nextChunk at fast retransmit; 0 when not recovering
+        simtime_t rtoDeadline;   // Go back to acked if no ACK advances by then
+        bool tcp = true;
+        double cwnd = 2.0;       // Kept across segments, like a persistent connection
+        double ssthresh = 64.0;
+        DctcpEstimator dctcp;
+    };
+    map<long, Transfer> transfers;
+    
+    long segmentsServed = 0;
+    long bytesServed = 0;
+    long dctcpReductions = 0;
+    long retransmits = 0;        // Chunks sent again
+    long retransmitTimeouts = 0;
+    
+    // Transmission queue management
+    cQueue txQueue;
+    cMessage* endTxEvent;
+    cMessage* retransmitEvt;
+    PacketPool pool;         // Recycled packets, see mk() and pool.release()
+    SegmentationOffload gso; // One chunk per wire segment
+    
+  protected:
+    // Pooled packet factory; shadows the global mk() inside this module
+    cPacket* mk(const char* name, int kind, long src, long dst) {
+        return pool.get(name, kind, src, dst);
+    }
+    
+    void initialize() override {
+        addr = par("address");
+        chunkBytes = par("chunkBytes");
+        chunkPriority = par("chunkPriority");
+        ecn = par("ecn").boolValue();
+        retransmitTimeout = par("retransmitTimeout").doubleValue();
+        
+        // Initialize transmission queue
+        txQueue.setName("txQueue");
+        endTxEvent = new cMessage("endTx");
+        retransmitEvt = new cMessage("retransmit");
+        gso.mss = chunkBytes;
+        
+        EV_INFO << "Video server " << addr << " initialized\n";
+    }
+    
+    void handleMessage(cMessage *msg) override {
+        if (msg->isSelfMessage()) {
+            if (msg == endTxEvent) {
+                // Transmission finished, send next packet if available
+                if (!txQueue.isEmpty()) {
+                    cMessage* nextMsg = (cMessage*)txQueue.pop();
+                    startTransmission(nextMsg);
+                }
+            } else if (msg == retransmitEvt) {
+                handleRetransmitTimeout();
+            }
+            return;
+        }
+        
+        switch (msg->getKind()) {
+            case VIDEO_REQUEST:
+                handleVideoRequest(msg);
+                break;
+            case TCP_ACK:
+                handleVideoAck(msg);
+                break;
+            default:
+                EV_WARN << "Video server unexpected kind=" << msg->getKind() << "\n";
+                pool.release(msg);
+        }
+    }
+    
+    void sendPacketOnGate(cMessage* msg) {
+        cGate* outGate = gate("ppp$o");
+        
+        // Check if channel is busy
+        simtime_t finishTime = outGate->getTransmissionChannel()->getTransmissionFinishTime();
+        if (finishTime > simTime() || endTxEvent->isScheduled()) {
+            txQueue.insert(msg);
+        } else {
+            startTransmission(msg);
+        }
+    }
+    
+    void startTransmission(cMessage* msg) {
+        cGate* outGate = gate("ppp$o");
+        msg = gso.next(msg, txQueue, pool);
+        send(msg, outGate);
+        
+        // Schedule end of transmission
+        simtime_t finishTime = outGate->getTransmissionChannel()->getTransmissionFinishTime();
+        if (endTxEvent->isScheduled()) {
+            cancelEvent(endTxEvent);
+        }
+        scheduleAt(finishTime, endTxEvent);
+    }
+    
+    void handleVideoRequest(cMessage* msg) {
+        long client = SRC(msg);
+        Transfer& t = transfers[client];
+        t.segment = msg->par("segment").longValue();
+        t.request = msg->hasPar("request") ? msg->par("request").longValue() : 0;
+        t.bytes = max(1L, msg->par("bytes").longValue());
+        t.chunks = (t.bytes + chunkBytes - 1) / chunkBytes;
+        t.nextChunk = 0;
+        t.acked = 0;
+        t.dupAcks = 0;
+        t.recover = 0;
+        t.rtoDeadline = simTime() + retransmitTimeout;
+        t.tcp = !msg->hasPar("protocol") || strcmp(msg->par("protocol").stringValue(), "UDP") != 0;
+        t.dctcp.restart((long)t.cwnd);
+        
+        EV_INFO << "Video server " << addr << " sending segment " << t.segment << " (" << t.bytes
+                << " bytes, " << t.chunks << " chunks, " << (t.tcp ? "TCP" : "UDP") << ") to "
+                << client << "\n";
+        segmentsServed++;
+        bytesServed += t.bytes;
+        sendChunks(client, t);
+        armRetransmitTimer();
+        pool.release(msg);
+    }
+    
+    void handleVideoAck(cMessage* msg) {
+        long client = SRC(msg);
+        auto it = transfers.find(client);
+        if (it != transfers.end() && it->second.tcp &&
+            msg->hasPar("segment") && msg->par("segment").longValue() == it->second.segment &&
+            msg->hasPar("request") && msg->par("request").longValue() == it->second.request) {
+            Transfer& t = it->second;
+            long ack = min(ACK(msg), t.nextChunk);  // Cumulative: next chunk expected in order
+            if (ack > t.acked) {
+                for (long i = t.acked; i < ack; i++) {
+                    t.cwnd += t.cwnd < t.ssthresh ? 1.0 : 1.0 / t.cwnd;
+                }
+                if (ecn && msg->hasPar("ecnEcho")) {
+                    double factor = t.dctcp.onAck(ack, ack - t.acked, msg->par("ecnEcho").longValue(), t.nextChunk);
+                    if (factor < 1.0) {
+                        t.cwnd = max(2.0, t.cwnd * factor);
+                        t.ssthresh = t.cwnd;
+                        dctcpReductions++;
+                        EV_INFO << "Video server " << addr << " DCTCP alpha=" << t.dctcp.alpha
+                                << ", cwnd=" << t.cwnd << " for " << client << "\n";
+                    }
+                }
+                t.acked = ack;
+                t.dupAcks = 0;
+                t.rtoDeadline = simTime() + retransmitTimeout;
+                if (t.recover > 0) {
+                    if (ack < t.recover) {
+                        resendChunk(client, t, ack);  // Partial ACK: the next hole is lost too
+                    } else {
+                        t.recover = 0;
+                    }
+                }
+                sendChunks(client, t);
+                armRetransmitTimer();
+            } else if (ack == t.acked && t.acked < t.nextChunk && t.recover == 0 && ++t.dupAcks == 3) {
+                // Fast retransmit of the chunk the client is missing
+                t.ssthresh = max(2.0, t.cwnd / 2);
+                t.cwnd = t.ssthresh;
+                t.recover = t.nextChunk;
+                EV_INFO << "Video server " << addr << " fast retransmit of chunk " << t.acked
+                        << " to " << client << ", cwnd=" << t.cwnd << "\n";
+                resendChunk(client, t, t.acked);
+            }
+        }
+        pool.release(msg);
+    }
+    
+    // Retransmission timer expiry: transfers with no ACK progress go back
+    // to their first unacknowledged chunk with a minimal window
+    void handleRetransmitTimeout() {
+        for (auto& entry : transfers) {
+            Transfer& t = entry.second;
+            if (!t.tcp || t.acked >= t.nextChunk || t.rtoDeadline > simTime()) continue;
+            EV_WARN << "Video server " << addr << " retransmission timeout for " << entry.first
+                    << ", resending segment " << t.segment << " from chunk " << t.acked << "\n";
+            retransmitTimeouts++;
+            retransmits += t.nextChunk - t.acked;
+            t.ssthresh = max(2.0, t.cwnd / 2);
+            t.cwnd = 2.0;
+            t.nextChunk = t.acked;
+            t.dupAcks = 0;
+            t.recover = 0;
+            t.rtoDeadline = simTime() + retransmitTimeout;
+            sendChunks(entry.first, t);
+        }
+        armRetransmitTimer();
+    }
+    
+    // Timer for the earliest deadline among transfers with chunks in flight
+    void armRetransmitTimer() {
+        simtime_t next = SIMTIME_MAX;
+        for (auto& entry : transfers) {
+            const Transfer& t = entry.second;
+            if (t.tcp && t.acked < t.nextChunk) next = min(next, t.rtoDeadline);
+        }
+        cancelEvent(retransmitEvt);
+        if (next < SIMTIME_MAX) scheduleAt(max(next, simTime()), retransmitEvt);
+    }
+    
+    // Everything the window allows goes out as one offloaded send
+    void sendChunks(long client, Transfer& t) {
+        long n = t.chunks - t.nextChunk;
+        if (t.tcp) n = min(n, (long)t.cwnd - (t.nextChunk - t.acked));
+        if (n <= 0) return;
+        sendChunkRange(client, t, t.nextChunk, n);
+        t.nextChunk += n;
+    }
+    
+    void resendChunk(long client, Transfer& t, long chunk) {
+        retransmits++;
+        sendChunkRange(client, t, chunk, 1);
+    }
+    
+    // Chunks first .. first + n - 1 of the transfer as one offloaded send
+    void sendChunkRange(long client, const Transfer& t, long first, long n) {
+        long last = first + n;
+        long bytes = (last == t.chunks ? t.bytes : last * chunkBytes) - first * chunkBytes;
+        
+        auto* chunks = mk("VIDEO_CHUNK", VIDEO_CHUNK, addr, client);
+        pool.addPar(chunks, "segment").setLongValue(t.segment);
+        pool.addPar(chunks, "request").setLongValue(t.request);
+        pool.addPar(chunks, "chunks").setLongValue(t.chunks);
+        pool.addPar(chunks, "bytes").setLongValue(bytes);
+        chunks->par("seq").setLongValue(first);
+        chunks->par("priority").setLongValue(chunkPriority);
+        if (ecn && t.tcp) pool.addPar(chunks, "ecn").setLongValue(ECN_ECT);
+        chunks->setByteLength(bytes + HEADER_BYTES);
+        gso.offload(chunks, pool);
+        sendPacketOnGate(chunks);
+    }
+    
+    void finish() override {
+        recordScalar("segmentsServed", segmentsServed);
+        recordScalar("videoBytesServed", bytesServed);
+        recordScalar("dctcpReductions", dctcpReductions);
+        recordScalar("videoRetransmits", retransmits);
+        recordScalar("videoRetransmitTimeouts", retransmitTimeouts);
+        pool.recordScalars(this);
+        gso.recordScalars(this);
+        
+        // Clean up transmission queue
+        cancelAndDelete(endTxEvent);
+        cancelAndDelete(retransmitEvt);
+        while (!txQueue.isEmpty()) {
+            delete txQueue.pop();
+        }
+    }
+};
+Define_Module(VideoServer);
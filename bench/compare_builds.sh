@@ -0,0 +1,48 @@
+#!/bin/sh
+# Wall-clock comparison of full simulation runs across build variants.
+# Run from bench/ with the OMNeT++ environment sourced; each variant is
+# built in its own copy of the sources so the working tree is untouched.
+#
+#   ./compare_builds.sh <config> <sim-time-limit> <runs> name[:opp_makemake flags] ...
+#
+# e.g. ./compare_builds.sh General 300s 3 xor "aes-gcm:-DHYBRID_CRYPTO_OPENSSL -lcrypto"
+
+CONFIG=$1
+LIMIT=$2
+RUNS=$3
+shift 3
+SRC=$(cd .. && pwd)
+WORK=${TMPDIR:-/tmp}/hybrid_bench
+
+build() {
+    name=$1; shift
+    rm -rf "$WORK/$name" && mkdir -p "$WORK/$name"
+    cp -r "$SRC/Modules" "$SRC"/*.ned "$SRC/omnetpp.ini" "$WORK/$name/"
+    (cd "$WORK/$name" && opp_makemake -f --deep -o hybrid_tcp_udp "$@" >/dev/null \
+        && make MODE=release -j"$(nproc)" >/dev/null) || exit 1
+}
+
+run() {
+    name=$1
+    best=
+    for i in $(seq "$RUNS"); do
+        start=$(date +%s.%N)
+        (cd "$WORK/$name" && ./hybrid_tcp_udp -u Cmdenv -c "$CONFIG" --cmdenv-express-mode=true \
+            --sim-time-limit="$LIMIT" --result-dir="$WORK/$name/results" >/dev/null) || exit 1
+        t=$(echo "$(date +%s.%N) - $start" | bc)
+        if [ -z "$best" ] || [ "$(echo "$t < $best" | bc)" = 1 ]; then best=$t; fi
+    done
+    printf "%-22s %8.2f s\n" "$name" "$best"
+}
+
+for variant in "$@"; do
+    name=${variant%%:*}
+    flags=
+    [ "$name" != "$variant" ] && flags=${variant#*:}
+    build "$name" $flags
+done
+
+echo "config $CONFIG, sim-time-limit $LIMIT, best of $RUNS runs"
+for variant in "$@"; do
+    run "${variant%%:*}"
+done
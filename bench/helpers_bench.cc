@@ -0,0 +1,266 @@
+// ns/op microbenchmarks for the per-packet primitives in Modules/helpers.h.
+// Links against the OMNeT++ simulation library but sets up no network; build
+// and run with `make -C bench run-helpers`.
+//
+// Inputs come from a fixed seed and each figure is the best of several
+// repetitions, so runs on the same machine are comparable. Pass a file saved
+// from an earlier run to fail on regressions:
+//   ./helpers_bench > base.txt; ...; ./helpers_bench base.txt
+
+#include "../Modules/helpers.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+static volatile long sink;
+
+// The same header as typed fields, as a .msg-generated class would hold it
+class TypedPacket : public cPacket {
+  public:
+    long src = 0, dst = 0, seq = 0, ack = 0;
+    int priority = PRIORITY_NORMAL;
+    int ttl = DEFAULT_TTL;
+    TypedPacket(const char* name, int kind) : cPacket(name, kind) { setByteLength(1000); }
+};
+
+struct TypedPriorityCompare {
+    bool operator()(TypedPacket* a, TypedPacket* b) { return a->priority < b->priority; }
+};
+
+static vector<pair<string, double>> results;
+
+// Best-of-N ns per op; fn performs 'ops' operations per call
+template <typename Fn>
+static void measure(const string& name, size_t ops, Fn fn) {
+    const int reps = 7;
+    double best = 1e30;
+    fn();  // Warm caches and allocators
+    for (int rep = 0; rep < reps; rep++) {
+        auto start = chrono::steady_clock::now();
+        fn();
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        best = min(best, ns / ops);
+    }
+    results.push_back(make_pair(name, best));
+    printf("%-36s %10.1f ns/op\n", name.c_str(), best);
+    fflush(stdout);
+}
+
+static void benchPackets() {
+    const size_t n = 100000;
+    measure("mk+delete", n, [&] {
+        for (size_t i = 0; i < n; i++) {
+            delete mk("DATA", TCP_DATA, (long)i, 401);
+        }
+    });
+    measure("typed new+delete", n, [&] {
+        for (size_t i = 0; i < n; i++) {
+            auto* m = new TypedPacket("DATA", TCP_DATA);
+            m->src = (long)i;
+            m->dst = 401;
+            delete m;
+        }
+    });
+
+    PacketPool pool;
+    measure("PacketPool get+release", n, [&] {
+        for (size_t i = 0; i < n; i++) {
+            pool.release(pool.get("DATA", TCP_DATA, (long)i, 401));
+        }
+    });
+    pool.clear();
+
+    // Header reads as a forwarding decision does them
+    cPacket* m = mk("DATA", TCP_DATA, 201, 401);
+    TypedPacket typed("DATA", TCP_DATA);
+    typed.src = 201;
+    typed.dst = 401;
+    measure("par read SRC+DST+PRIORITY", n, [&] {
+        long acc = 0;
+        for (size_t i = 0; i < n; i++) {
+            acc += SRC(m) + DST(m) + PRIORITY(m);
+        }
+        sink = acc;
+    });
+    TypedPacket* volatile typedRef = &typed;  // Keeps the reads inside the loop
+    measure("typed read src+dst+priority", n, [&] {
+        long acc = 0;
+        for (size_t i = 0; i < n; i++) {
+            TypedPacket* t = typedRef;
+            acc += t->src + t->dst + t->priority;
+        }
+        sink = acc;
+    });
+    measure("par write seq", n, [&] {
+        for (size_t i = 0; i < n; i++) {
+            m->par("seq").setLongValue((long)i);
+        }
+    });
+    delete m;
+}
+
+static void benchSynCookies() {
+    const size_t n = 1000000;
+    mt19937 rng(1);
+    vector<long> seqs(4096);
+    for (auto& s : seqs) s = rng() % 9000 + 1000;
+    measure("generateSYNCookie", n, [&] {
+        long acc = 0;
+        for (size_t i = 0; i < n; i++) {
+            acc ^= generateSYNCookie(201 + (long)(i & 7), 401, seqs[i & 4095]);
+        }
+        sink = acc;
+    });
+    measure("validateSYNCookie", n, [&] {
+        long acc = 0;
+        for (size_t i = 0; i < n; i++) {
+            long seq = seqs[i & 4095];
+            acc += validateSYNCookie(generateSYNCookie(201, 401, seq), 201, 401, seq);
+        }
+        sink = acc;
+    });
+}
+
+static void benchEncrypt() {
+    const CipherKey key(computeSharedSecret(generateECDHPublicKey(201),
+                                            deriveECDHPublicKey(generateECDHPublicKey(401))));
+    for (size_t size : {64, 512, 1400}) {
+        string data(size, 'q');
+        const size_t n = 20000;
+        measure("simpleEncrypt " + to_string(size) + "B", n, [&] {
+            for (size_t i = 0; i < n; i++) {
+                data[0] = (char)i;
+                sink = (long)simpleEncrypt(data, key).size();
+            }
+        });
+    }
+}
+
+// One op = one push plus one pop at a steady queue depth
+static void benchPriorityQueue() {
+    const size_t n = 100000;
+    mt19937 rng(2);
+    for (size_t depth : {16, 1024}) {
+        vector<cMessage*> msgs;
+        vector<TypedPacket*> typed;
+        for (size_t i = 0; i < depth + 1; i++) {
+            int prio = (int)(rng() % 4);
+            cPacket* m = mk("Q", TCP_DATA, 201, 401);
+            m->par("priority").setLongValue(prio);
+            msgs.push_back(m);
+            typed.push_back(new TypedPacket("Q", TCP_DATA));
+            typed.back()->priority = prio;
+        }
+
+        measure("priority_queue par depth=" + to_string(depth), n, [&] {
+            priority_queue<cMessage*, vector<cMessage*>, MessagePriorityCompare> q;
+            for (size_t i = 0; i < depth; i++) q.push(msgs[i]);
+            cMessage* next = msgs[depth];
+            for (size_t i = 0; i < n; i++) {
+                q.push(next);
+                next = q.top();
+                q.pop();
+            }
+        });
+        measure("priority_queue typed depth=" + to_string(depth), n, [&] {
+            priority_queue<TypedPacket*, vector<TypedPacket*>, TypedPriorityCompare> q;
+            for (size_t i = 0; i < depth; i++) q.push(typed[i]);
+            TypedPacket* next = typed[depth];
+            for (size_t i = 0; i < n; i++) {
+                q.push(next);
+                next = q.top();
+                q.pop();
+            }
+        });
+
+        for (auto* m : msgs) delete m;
+        for (auto* t : typed) delete t;
+    }
+}
+
+// Router::routingTable lookups of known destinations, random order
+static void benchRoutingTable() {
+    const size_t n = 1000000;
+    mt19937 rng(3);
+    for (size_t size : {16, 256, 4096, 65536}) {
+        map<long, RouteEntry> table;
+        vector<long> keys;
+        while (table.size() < size) {
+            long dest = (long)(rng() % 1000000);
+            if (table.count(dest)) continue;
+            RouteEntry re;
+            re.destAddr = dest;
+            re.nextHop = (int)(dest % 4);
+            re.metric = 1;
+            table[dest] = re;
+            keys.push_back(dest);
+        }
+        vector<long> lookups(65536);
+        for (auto& k : lookups) k = keys[rng() % keys.size()];
+
+        measure("routingTable.find size=" + to_string(size), n, [&] {
+            long acc = 0;
+            for (size_t i = 0; i < n; i++) {
+                auto it = table.find(lookups[i & 65535]);
+                if (it != table.end()) acc += it->second.nextHop;
+            }
+            sink = acc;
+        });
+    }
+}
+
+// Compares against a saved run; returns the number of regressions
+static int compareBaseline(const char* path, double tolerance) {
+    ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "cannot read baseline %s\n", path);
+        return 1;
+    }
+    map<string, double> baseline;
+    string line;
+    while (getline(in, line)) {
+        size_t unit = line.rfind(" ns/op");
+        if (unit == string::npos) continue;
+        size_t valueStart = line.find_last_of(' ', unit - 1);
+        string name = line.substr(0, valueStart);
+        name.erase(name.find_last_not_of(' ') + 1);
+        baseline[name] = atof(line.substr(valueStart + 1, unit - valueStart - 1).c_str());
+    }
+
+    int regressions = 0;
+    for (auto& r : results) {
+        auto it = baseline.find(r.first);
+        if (it == baseline.end() || it->second <= 0) continue;
+        double change = (r.second - it->second) / it->second;
+        if (change > tolerance) {
+            fprintf(stderr, "REGRESSION %-36s %10.1f -> %10.1f ns/op (%+.0f%%)\n",
+                    r.first.c_str(), it->second, r.second, change * 100);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    // cMessage construction reads the simulation clock, so give it a
+    // simulation to belong to; no network is built and no events run
+    cSimulation* sim = new cSimulation("helpers_bench", new cNullEnvir(argc, argv, nullptr));
+    cSimulation::setActiveSimulation(sim);
+
+    benchPackets();
+    benchSynCookies();
+    benchEncrypt();
+    benchPriorityQueue();
+    benchRoutingTable();
+
+    int regressions = 0;
+    if (argc > 1) {
+        double tolerance = argc > 2 ? atof(argv[2]) / 100.0 : 0.25;
+        regressions = compareBaseline(argv[1], tolerance);
+    }
+
+    cSimulation::setActiveSimulation(nullptr);
+    delete sim;
+    return regressions ? 1 : 0;
+}
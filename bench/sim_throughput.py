@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Simulator throughput benchmark: events/s, simulated-s/s and peak RSS.
+
+Builds the model in release mode in a scratch copy of the sources (like
+compare_builds.sh), generates LargeNet topologies of the requested sizes
+next to SimpleNet, runs each one under the [Config Throughput] settings in
+Cmdenv express mode and appends one CSV row per run. Run from bench/ with
+the OMNeT++ environment sourced:
+
+    ./sim_throughput.py                          # SimpleNet + default sizes
+    ./sim_throughput.py --sizes 10x10 50x20 --runs 5 --label router-v2
+    ./sim_throughput.py --sizes 100x50 --routing ORACLE --label oracle
+    ./sim_throughput.py --emit-ned /tmp/nets --sizes 100x50   # NED only
+
+A size SxP is S client subnets with P PCs each, behind one core router,
+with the DNS/HTTP/mail/database servers on a services subnet. The routers
+carry no static routes: they discover their neighbors and learn the rest
+through OSPF-TE, or through ORACLE with --routing ORACLE. Results from
+different builds or revisions line up by label in the same CSV.
+"""
+
+import argparse
+import csv
+import datetime
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+SRC = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+WORK = os.path.join(os.environ.get("TMPDIR", "/tmp"), "hybrid_bench")
+DEFAULT_SIZES = ["4x8", "16x16", "64x32"]
+
+# Services subnet: same addresses as SimpleNet, which PC expects
+SERVERS = [
+    ("clientDNS", "DNS", 301, "answerAddr = 401;\n                rateLimit = 1000000;"),
+    ("webServer1", "HTTP", 401, "serviceTime = 3ms;\n                pageSizeBytes = 20000;"),
+    ("webServer2", "HTTP", 402, "serviceTime = 3ms;\n                pageSizeBytes = 20000;"),
+    ("mailServer", "MailServer", 501, "serviceTime = 8ms;\n                mailSizeBytes = 50000;"),
+    ("dbServer", "DatabaseServer", 601, "queryTime = 5ms;\n                responseBytes = 10000;"),
+]
+PROTOCOLS = ["TCP", "UDP", "AUTO"]
+
+
+def network_name(subnets, pcs):
+    return "LargeNet_%dx%d" % (subnets, pcs)
+
+
+def pc_address(subnet, index):
+    return 100000 + subnet * 1000 + index
+
+
+def generate_ned(subnets, pcs):
+    """Tree topology; routers learn their routes by discovery and routing."""
+    if pcs > 999:
+        sys.exit("at most 999 PCs per subnet")
+
+    out = []
+    w = out.append
+    w("// Generated by bench/sim_throughput.py; do not edit\n")
+    w("package hybrid_tcp_udp;\n\n")
+    w("network %s\n{\n    submodules:\n" % network_name(subnets, pcs))
+    w("        coreRouter: Router {\n            parameters:\n")
+    w("                address = 100;\n")
+    w("                synRateLimit = 1000000;\n        }\n")
+    w("        servicesRouter: Router {\n            parameters:\n")
+    w("                address = 400;\n")
+    w("                synRateLimit = 1000000;\n        }\n")
+    for name, ned_type, addr, extra in SERVERS:
+        w("        %s: %s {\n            parameters:\n" % (name, ned_type))
+        w("                address = %d;\n                %s\n        }\n" % (addr, extra))
+    for s in range(subnets):
+        w("        accessRouter%d: Router {\n            parameters:\n" % s)
+        w("                address = %d;\n" % (1000 + s))
+        w("                synRateLimit = 1000000;\n        }\n")
+        for i in range(pcs):
+            w("        clientPC%d_%d: PC {\n            parameters:\n" % (s, i))
+            w("                address = %d;\n                dnsAddr = 301;\n" % pc_address(s, i))
+            w("                protocol = \"%s\";\n" % PROTOCOLS[(s + i) % len(PROTOCOLS)])
+            w("                startAt = %gs;\n        }\n" % (0.5 + 0.001 * (s * pcs + i)))
+    w("    connections:\n")
+    w("        servicesRouter.pppg++ <--> GigabitEthernet <--> coreRouter.pppg++;\n")
+    for name, _, _, _ in SERVERS:
+        w("        %s.ppp <--> GigabitEthernet <--> servicesRouter.pppg++;\n" % name)
+    for s in range(subnets):
+        w("        accessRouter%d.pppg++ <--> GigabitEthernet <--> coreRouter.pppg++;\n" % s)
+        for i in range(pcs):
+            w("        clientPC%d_%d.ppp <--> FastEthernet <--> accessRouter%d.pppg++;\n" % (s, i, s))
+    w("}\n")
+    return "".join(out)
+
+
+def parse_size(text):
+    m = re.fullmatch(r"(\d+)x(\d+)", text)
+    if not m:
+        raise argparse.ArgumentTypeError("size must look like 16x16, got %r" % text)
+    return int(m.group(1)), int(m.group(2))
+
+
+def build(src, work, flags):
+    shutil.rmtree(work, ignore_errors=True)
+    os.makedirs(work)
+    shutil.copytree(os.path.join(src, "Modules"), os.path.join(work, "Modules"))
+    for f in os.listdir(src):
+        if f.endswith(".ned") or f == "omnetpp.ini":
+            shutil.copy(os.path.join(src, f), work)
+    subprocess.run(["opp_makemake", "-f", "--deep", "-o", "hybrid_tcp_udp"] + flags,
+                   cwd=work, check=True, stdout=subprocess.DEVNULL)
+    subprocess.run(["make", "MODE=release", "-j%d" % os.cpu_count()],
+                   cwd=work, check=True, stdout=subprocess.DEVNULL)
+
+
+def run_once(work, network, limit, routing):
+    """Returns (wall seconds, events, simulated seconds, peak RSS in KiB)."""
+    cmd = ["./hybrid_tcp_udp", "-u", "Cmdenv", "-c", "Throughput",
+           "--network=" + network, "--sim-time-limit=" + limit,
+           "--result-dir=" + os.path.join(work, "results")]
+    if routing:
+        cmd.append("--**.routingProtocol=" + routing)
+    with tempfile.TemporaryFile(mode="w+") as log:
+        start = time.monotonic()
+        proc = subprocess.Popen(cmd, cwd=work, stdout=log, stderr=subprocess.STDOUT)
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall = time.monotonic() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        log.seek(0)
+        output = log.read()
+    if proc.returncode != 0:
+        sys.stderr.write(output[-2000:])
+        sys.exit("%s failed with exit code %d" % (network, proc.returncode))
+
+    # Cmdenv ends with e.g. "Simulation time limit reached -- at t=120s, event #1234"
+    events = [int(e) for e in re.findall(r"[Ee]vent #(\d+)", output)]
+    simtimes = re.findall(r"at t=([0-9.eE+-]+)s?, event #", output)
+    if not events:
+        sys.exit("could not find the event count in the %s output" % network)
+    simsec = float(simtimes[-1]) if simtimes else float(limit.rstrip("s"))
+    return wall, events[-1], simsec, usage.ru_maxrss
+
+
+def git_revision(src):
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=src, check=True,
+                              capture_output=True, text=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ""
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--sizes", nargs="*", type=parse_size,
+                    default=[parse_size(s) for s in DEFAULT_SIZES],
+                    help="LargeNet sizes as SUBNETSxPCS (default: %s)" % " ".join(DEFAULT_SIZES))
+    ap.add_argument("--no-simplenet", action="store_true", help="skip the SimpleNet run")
+    ap.add_argument("--limit", default="120s", help="sim-time-limit per run (default 120s)")
+    ap.add_argument("--runs", type=int, default=3, help="runs per network (default 3)")
+    ap.add_argument("--csv", default="sim_throughput.csv", help="CSV file to append to")
+    ap.add_argument("--label", default="", help="tag for this build in the CSV")
+    ap.add_argument("--src", default=SRC, help="source tree to build (default: this one)")
+    ap.add_argument("--routing", default="", help="override routingProtocol, e.g. ORACLE")
+    ap.add_argument("--flags", default="", help="extra opp_makemake flags, e.g. -DHYBRID_NO_PACKET_POOL")
+    ap.add_argument("--emit-ned", metavar="DIR", help="only write the LargeNet NED files to DIR")
+    args = ap.parse_args()
+
+    if args.emit_ned:
+        os.makedirs(args.emit_ned, exist_ok=True)
+        for subnets, pcs in args.sizes:
+            path = os.path.join(args.emit_ned, network_name(subnets, pcs) + ".ned")
+            with open(path, "w") as f:
+                f.write(generate_ned(subnets, pcs))
+            print(path)
+        return
+
+    src = os.path.abspath(args.src)
+    work = os.path.join(WORK, "throughput")
+    build(src, work, args.flags.split())
+
+    networks = [] if args.no_simplenet else [("SimpleNet", "")]
+    for subnets, pcs in args.sizes:
+        name = network_name(subnets, pcs)
+        with open(os.path.join(work, name + ".ned"), "w") as f:
+            f.write(generate_ned(subnets, pcs))
+        networks.append((name, "%dx%d" % (subnets, pcs)))
+
+    fields = ["date", "revision", "label", "network", "size", "sim_time_limit", "run",
+              "wall_s", "events", "events_per_s", "simsec_per_s", "peak_rss_kb"]
+    new_file = not os.path.exists(args.csv)
+    revision = git_revision(src)
+    with open(args.csv, "a", newline="") as f:
+        out = csv.writer(f)
+        if new_file:
+            out.writerow(fields)
+        print("%-20s %4s %9s %12s %12s %12s %10s" % ("network", "run", "wall s", "events",
+                                                   "events/s", "simsec/s", "RSS KiB"))
+        for name, size in networks:
+            for run in range(args.runs):
+                wall, events, simsec, rss = run_once(work, name, args.limit, args.routing)
+                row = [datetime.datetime.now().isoformat(timespec="seconds"), revision,
+                       args.label, name, size, args.limit, run, "%.3f" % wall, events,
+                       "%.0f" % (events / wall), "%.3f" % (simsec / wall), rss]
+                out.writerow(row)
+                f.flush()
+                print("%-20s %4d %9.2f %12d %12.0f %12.3f %10d" % (name, run, wall, events,
+                                                                  events / wall, simsec / wall, rss))
+
+
+if __name__ == "__main__":
+    main()